@@ -0,0 +1,164 @@
+/* per-row and per-column aggregates in one pass over a strip
+
+   aggregateRows walks rows first..last in tiles of AGG_TILEROWS rows by
+   AGG_TILECOLS columns. For each row segment of a tile it runs
+   rowReduce, adding to the statistics of the row, and then folds the
+   same segment, still in L1, into the column accumulators of the
+   tile, which stay in cache for all AGG_TILEROWS rows. Every element is
+   thus read from memory once for both directions.
+
+   Each worker keeps its own column accumulators and columnMerge
+   combines them afterwards, earlier rows first, so that like rowReduce
+   the positions are those of the first occurrence.
+
+*/
+#ifndef AGGREGATES_H
+#define AGGREGATES_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include "rowKernel.h"
+#include "matrixBuffer.h"
+
+#define AGG_TILEROWS 8     /* rows per tile */
+#define AGG_TILECOLS 2048  /* columns per tile; its accumulators take 48 KB */
+
+/* the aggregates of cols columns, one array per field so that the
+   columns can be folded 8 at a time */
+typedef struct {
+  long long *sum;
+  int *maxValue, *maxi; /* largest value and its first row */
+  int *minValue, *mini; /* smallest value and its first row */
+} columnStats;
+
+/* Allocate accumulators for cols columns. Returns false without memory */
+static inline bool columnStatsAlloc(columnStats *c, int cols) {
+  c->sum = malloc(cols * sizeof(long long));
+  c->maxValue = malloc(cols * sizeof(int));
+  c->maxi = malloc(cols * sizeof(int));
+  c->minValue = malloc(cols * sizeof(int));
+  c->mini = malloc(cols * sizeof(int));
+  return c->sum != NULL && c->maxValue != NULL && c->maxi != NULL
+         && c->minValue != NULL && c->mini != NULL;
+}
+
+/* add row i, a[0..n-1], to the column accumulators */
+static void columnFoldScalar(const int *a, int n, int i, long long *sum,
+                             int *maxValue, int *maxi, int *minValue, int *mini) {
+  int j;
+
+  for (j = 0; j < n; j++) {
+    sum[j] += a[j];
+    if (maxValue[j] < a[j]) {
+      maxValue[j] = a[j];
+      maxi[j] = i;
+    }
+    if (minValue[j] > a[j]) {
+      minValue[j] = a[j];
+      mini[j] = i;
+    }
+  }
+}
+
+#ifdef ROWKERNEL_X86
+/* 8 columns at a time; the sums are widened to 64 bits 4 at a time */
+__attribute__((target("avx2")))
+static void columnFoldAvx2(const int *a, int n, int i, long long *sum,
+                           int *maxValue, int *maxi, int *minValue, int *mini) {
+  __m256i v, row, mx, mn, gt, lt;
+  int j;
+
+  row = _mm256_set1_epi32(i);
+  for (j = 0; j + 8 <= n; j += 8) {
+    v = _mm256_loadu_si256((const __m256i *) (a + j));
+    mx = _mm256_loadu_si256((const __m256i *) (maxValue + j));
+    mn = _mm256_loadu_si256((const __m256i *) (minValue + j));
+    gt = _mm256_cmpgt_epi32(v, mx);
+    lt = _mm256_cmpgt_epi32(mn, v);
+    _mm256_storeu_si256((__m256i *) (maxValue + j), _mm256_max_epi32(mx, v));
+    _mm256_storeu_si256((__m256i *) (minValue + j), _mm256_min_epi32(mn, v));
+    _mm256_storeu_si256((__m256i *) (maxi + j),
+                        _mm256_blendv_epi8(_mm256_loadu_si256((const __m256i *) (maxi + j)), row, gt));
+    _mm256_storeu_si256((__m256i *) (mini + j),
+                        _mm256_blendv_epi8(_mm256_loadu_si256((const __m256i *) (mini + j)), row, lt));
+    _mm256_storeu_si256((__m256i *) (sum + j),
+                        _mm256_add_epi64(_mm256_loadu_si256((const __m256i *) (sum + j)),
+                                         _mm256_cvtepi32_epi64(_mm256_castsi256_si128(v))));
+    _mm256_storeu_si256((__m256i *) (sum + j + 4),
+                        _mm256_add_epi64(_mm256_loadu_si256((const __m256i *) (sum + j + 4)),
+                                         _mm256_cvtepi32_epi64(_mm256_extracti128_si256(v, 1))));
+  }
+  columnFoldScalar(a + j, n - j, i, sum + j, maxValue + j, maxi + j, minValue + j, mini + j);
+}
+#endif
+
+/* Reduce rows first..last of m into rows[first..last] and into the
+   column accumulators c. With fresh the accumulators are started from
+   row first rather than added to. The columns use AVX2 unless
+   rowKernelInit chose the scalar kernel */
+static inline void aggregateRows(const matrixBuffer *m, int cols, int first, int last,
+                                 bool fresh, rowStats *rows, const columnStats *c) {
+  int i, j, j0, n;
+  const int *a;
+  rowStats part;
+  long long *sum;
+  int *maxValue, *maxi, *minValue, *mini;
+  void (*fold)(const int *, int, int, long long *, int *, int *, int *, int *) = columnFoldScalar;
+
+#ifdef ROWKERNEL_X86
+  if (rowReduce != rowReduceScalar) fold = columnFoldAvx2;
+#endif
+
+  for (j0 = 0; j0 < cols; j0 += AGG_TILECOLS) {
+    n = (cols - j0 < AGG_TILECOLS) ? cols - j0 : AGG_TILECOLS;
+    sum = c->sum + j0;
+    maxValue = c->maxValue + j0;
+    maxi = c->maxi + j0;
+    minValue = c->minValue + j0;
+    mini = c->mini + j0;
+    for (i = first; i <= last; i++) {
+      a = matrixRow(m, i) + j0;
+
+      /* the row */
+      rowReduce(a, n, &part);
+      if (j0 == 0)
+        rows[i] = part;
+      else {
+        rows[i].sum += part.sum;
+        if (rows[i].maxValue < part.maxValue) {
+          rows[i].maxValue = part.maxValue;
+          rows[i].maxj = j0 + part.maxj;
+        }
+        if (rows[i].minValue > part.minValue) {
+          rows[i].minValue = part.minValue;
+          rows[i].minj = j0 + part.minj;
+        }
+      }
+
+      /* the columns */
+      if (fresh && i == first) {
+        for (j = 0; j < n; j++) {
+          sum[j] = maxValue[j] = minValue[j] = a[j];
+          maxi[j] = mini[j] = i;
+        }
+        continue;
+      }
+      fold(a, n, i, sum, maxValue, maxi, minValue, mini);
+    }
+  }
+}
+
+/* add the aggregates of column jb of b, over later rows, to column ja of a */
+static inline void columnMerge(const columnStats *a, int ja, const columnStats *b, int jb) {
+  a->sum[ja] += b->sum[jb];
+  if (a->maxValue[ja] < b->maxValue[jb]) {
+    a->maxValue[ja] = b->maxValue[jb];
+    a->maxi[ja] = b->maxi[jb];
+  }
+  if (a->minValue[ja] > b->minValue[jb]) {
+    a->minValue[ja] = b->minValue[jb];
+    a->mini[ja] = b->mini[jb];
+  }
+}
+
+#endif /* AGGREGATES_H */
@@ -0,0 +1,267 @@
+/* reusable barriers for a fixed set of numThreads threads
+
+   Every thread calls barrierWait(b, myid) with its own id in
+   0..numThreads-1. Four kinds can be chosen at run time:
+
+     mutex          the counter barrier of matrixSum.c: a mutex and a
+                    condition variable broadcast
+     sense          sense-reversing counter: one atomic decrement per
+                    arrival, the last one flips a shared sense flag
+     tree           combining tree: arrivals are counted in nodes of
+                    BARRIER_FANIN threads, only the last arrival at a
+                    node goes on to its parent; the root flips the sense
+     dissemination  ceil(log2 numThreads) rounds in which thread i
+                    signals thread i + 2^round and waits for its own
+                    signal; no thread ever waits on a shared counter
+
+   The spinning kinds spin for BARRIER_SPINS polls and then sleep on a
+   futex (sched_yield where there is none). When there are more threads
+   than cores they do not spin at all, since the thread being waited for
+   may need the core of the spinner.
+
+*/
+#ifndef BARRIER_H
+#define BARRIER_H
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <limits.h>
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+
+#define BARRIER_MUTEX 0
+#define BARRIER_SENSE 1
+#define BARRIER_TREE 2
+#define BARRIER_DISSEMINATION 3
+#define BARRIER_KINDS 4
+
+#define BARRIER_FANIN 4     /* children per combining tree node */
+#define BARRIER_SPINS 4000  /* polls before a waiter goes to sleep */
+#define BARRIER_ROUNDS 32   /* enough dissemination rounds for any int */
+#define BARRIER_LINE 64     /* bytes in a cache line */
+
+static const char *barrierNames[BARRIER_KINDS] = { "mutex", "sense", "tree", "dissemination" };
+
+/* one flag on its own cache line */
+typedef struct {
+  _Alignas(BARRIER_LINE) atomic_int value;
+} barrierFlag;
+
+/* a combining tree node */
+typedef struct {
+  _Alignas(BARRIER_LINE) atomic_int count; /* arrivals still expected */
+  int fanIn;                               /* arrivals per episode */
+  int parent;                              /* -1 at the root */
+} barrierNode;
+
+/* what each thread keeps between episodes */
+typedef struct {
+  _Alignas(BARRIER_LINE) int sense;
+  int parity;                   /* dissemination: which flag set to use */
+  barrierFlag flags[2][BARRIER_ROUNDS]; /* dissemination: signals to me */
+} barrierThread;
+
+typedef struct {
+  int kind, numThreads;
+  int spins;            /* polls before sleeping */
+  /* mutex */
+  pthread_mutex_t lock;
+  pthread_cond_t go;
+  int arrived;
+  int generation;       /* episodes completed, guards against spurious wakeups */
+  /* sense and tree */
+  barrierFlag count;    /* sense: arrivals still expected */
+  barrierFlag sense;    /* flipped by the last arrival */
+  barrierNode *nodes;   /* tree: leaves first, root last */
+  int rounds;           /* dissemination */
+  barrierThread *threads;
+  barrierFlag sleepers; /* waiters that may be asleep on a futex */
+} barrierState;
+
+static inline void *barrierAlloc(size_t bytes) {
+  void *p;
+#ifdef _WIN32
+  p = _aligned_malloc(bytes, BARRIER_LINE);
+#else
+  if (posix_memalign(&p, BARRIER_LINE, bytes) != 0) p = NULL;
+#endif
+  if (p != NULL) memset(p, 0, bytes);
+  return p;
+}
+
+static inline void barrierRelease(void *p) {
+#ifdef _WIN32
+  _aligned_free(p);
+#else
+  free(p);
+#endif
+}
+
+static inline void barrierPause(void) {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  __builtin_ia32_pause();
+#endif
+}
+
+/* wait until *word == value: spin first, then sleep */
+static inline void barrierAwait(barrierState *b, atomic_int *word, int value) {
+  int i, seen;
+
+  for (i = 0; i < b->spins; i++) {
+    if (atomic_load_explicit(word, memory_order_acquire) == value) return;
+    barrierPause();
+  }
+  atomic_fetch_add(&b->sleepers.value, 1);
+  while ((seen = atomic_load(word)) != value) {
+#ifdef __linux__
+    syscall(SYS_futex, (int *) word, FUTEX_WAIT_PRIVATE, seen, NULL, NULL, 0);
+#else
+    sched_yield();
+#endif
+  }
+  atomic_fetch_sub(&b->sleepers.value, 1);
+}
+
+/* *word = value, waking anyone asleep on it */
+static inline void barrierSignal(barrierState *b, atomic_int *word, int value) {
+  atomic_store(word, value);
+#ifdef __linux__
+  if (atomic_load(&b->sleepers.value) > 0)
+    syscall(SYS_futex, (int *) word, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+#else
+  (void) b;
+#endif
+}
+
+/* kind for a name, -1 if there is none */
+static inline int barrierKind(const char *name) {
+  int k;
+
+  for (k = 0; k < BARRIER_KINDS; k++)
+    if (strcmp(name, barrierNames[k]) == 0) return k;
+  return -1;
+}
+
+/* Set up b for numThreads threads. Returns false without memory */
+static inline bool barrierInit(barrierState *b, int kind, int numThreads) {
+  int i, level, width, next, numNodes;
+
+  memset(b, 0, sizeof(*b));
+  b->kind = kind;
+  b->numThreads = numThreads;
+  b->spins = BARRIER_SPINS;
+#ifdef __linux__
+  if (numThreads > sysconf(_SC_NPROCESSORS_ONLN)) b->spins = 0;
+#endif
+  pthread_mutex_init(&b->lock, NULL);
+  pthread_cond_init(&b->go, NULL);
+  atomic_init(&b->count.value, numThreads);
+  b->threads = barrierAlloc(numThreads * sizeof(barrierThread));
+  if (b->threads == NULL) return false;
+  for (i = 0; i < numThreads; i++)
+    b->threads[i].sense = 1;
+
+  if (kind == BARRIER_TREE) {
+    /* every level has a node per BARRIER_FANIN members of the level below */
+    numNodes = 0;
+    for (width = numThreads; ; width = (width + BARRIER_FANIN - 1) / BARRIER_FANIN) {
+      numNodes += (width + BARRIER_FANIN - 1) / BARRIER_FANIN;
+      if (width <= BARRIER_FANIN) break;
+    }
+    b->nodes = barrierAlloc(numNodes * sizeof(barrierNode));
+    if (b->nodes == NULL) return false;
+    level = 0;
+    for (width = numThreads; ; width = next) {
+      next = (width + BARRIER_FANIN - 1) / BARRIER_FANIN;
+      for (i = 0; i < next; i++) {
+        b->nodes[level + i].fanIn = (i < next - 1 || width % BARRIER_FANIN == 0)
+                                    ? BARRIER_FANIN : width % BARRIER_FANIN;
+        atomic_init(&b->nodes[level + i].count, b->nodes[level + i].fanIn);
+        b->nodes[level + i].parent = (next == 1) ? -1 : level + next + i / BARRIER_FANIN;
+      }
+      level += next;
+      if (next == 1) break;
+    }
+  }
+
+  for (b->rounds = 0; (1 << b->rounds) < numThreads; b->rounds++)
+    ;
+  return true;
+}
+
+static inline void barrierDestroy(barrierState *b) {
+  pthread_mutex_destroy(&b->lock);
+  pthread_cond_destroy(&b->go);
+  barrierRelease(b->nodes);
+  barrierRelease(b->threads);
+  b->nodes = NULL;
+  b->threads = NULL;
+}
+
+/* wait until all numThreads threads have called barrierWait */
+static inline void barrierWait(barrierState *b, long myid) {
+  barrierThread *me = &b->threads[myid];
+  int node, r, sense;
+
+  switch (b->kind) {
+  case BARRIER_MUTEX:
+    pthread_mutex_lock(&b->lock);
+    b->arrived++;
+    if (b->arrived == b->numThreads) {
+      b->arrived = 0;
+      b->generation++;
+      pthread_cond_broadcast(&b->go);
+    } else {
+      r = b->generation;
+      while (r == b->generation)
+        pthread_cond_wait(&b->go, &b->lock);
+    }
+    pthread_mutex_unlock(&b->lock);
+    break;
+
+  case BARRIER_SENSE:
+    sense = me->sense;
+    me->sense = !sense;
+    if (atomic_fetch_sub(&b->count.value, 1) == 1) {
+      atomic_store(&b->count.value, b->numThreads);
+      barrierSignal(b, &b->sense.value, sense);
+    } else
+      barrierAwait(b, &b->sense.value, sense);
+    break;
+
+  case BARRIER_TREE:
+    sense = me->sense;
+    me->sense = !sense;
+    node = (int) (myid / BARRIER_FANIN);
+    while (atomic_fetch_sub(&b->nodes[node].count, 1) == 1) {
+      /* last at this node: reset it and carry on up */
+      atomic_store(&b->nodes[node].count, b->nodes[node].fanIn);
+      node = b->nodes[node].parent;
+      if (node < 0) {
+        barrierSignal(b, &b->sense.value, sense);
+        return;
+      }
+    }
+    barrierAwait(b, &b->sense.value, sense);
+    break;
+
+  case BARRIER_DISSEMINATION:
+    for (r = 0; r < b->rounds; r++) {
+      barrierSignal(b, &b->threads[(myid + (1L << r)) % b->numThreads].flags[me->parity][r].value,
+                    me->sense);
+      barrierAwait(b, &me->flags[me->parity][r].value, me->sense);
+    }
+    if (me->parity == 1) me->sense = !me->sense;
+    me->parity = 1 - me->parity;
+    break;
+  }
+}
+
+#endif /* BARRIER_H */
@@ -0,0 +1,104 @@
+/* barrier microbenchmark
+
+   features: for every barrier kind of barrier.h and every thread count
+             2, 4, 8, ... up to maxThreads, the threads pass a number of
+             warm-up barriers and then a timed run of episodes barriers;
+             prints the barrier episodes per second and the time per
+             episode as CSV
+
+   usage under Linux:
+     gcc barrierBench.c -lpthread
+     a.out [maxThreads] [episodes] [kind ...]
+
+     maxThreads defaults to 64 or the number of cores if that is more;
+     the kinds default to all of mutex, sense, tree and dissemination
+
+*/
+#ifndef _REENTRANT
+#define _REENTRANT
+#endif
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "barrier.h"
+#define MAXTHREADS 1024    /* largest thread count */
+#define WARMUP 100         /* untimed episodes before each run */
+
+barrierState barrier;      /* barrier under test */
+int numThreads;            /* threads in this run */
+int episodes;              /* timed episodes per run */
+double start_time, end_time;
+
+/* monotonic timer */
+double read_timer() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + 1.0e-9 * t.tv_nsec;
+}
+
+/* every thread passes the barrier WARMUP + episodes times */
+void *Worker(void *arg) {
+  long myid = (long) arg;
+  int i;
+
+  for (i = 0; i < WARMUP; i++)
+    barrierWait(&barrier, myid);
+  if (myid == 0) start_time = read_timer();
+  for (i = 0; i < episodes; i++)
+    barrierWait(&barrier, myid);
+  if (myid == 0) end_time = read_timer();
+  return NULL;
+}
+
+int main(int argc, char *argv[]) {
+  int kinds[BARRIER_KINDS], numKinds, maxThreads, i, k;
+  long l, cores = sysconf(_SC_NPROCESSORS_ONLN);
+  pthread_t tid[MAXTHREADS];
+  double elapsed;
+
+  maxThreads = (argc > 1)? atoi(argv[1]) : (cores > 64 ? (int) cores : 64);
+  episodes = (argc > 2)? atoi(argv[2]) : 10000;
+  if (maxThreads < 2) maxThreads = 2;
+  if (maxThreads > MAXTHREADS) maxThreads = MAXTHREADS;
+  if (episodes < 1) episodes = 1;
+  numKinds = 0;
+  for (i = 3; i < argc && numKinds < BARRIER_KINDS; i++) {
+    kinds[numKinds] = barrierKind(argv[i]);
+    if (kinds[numKinds] < 0) {
+      fprintf(stderr, "unknown barrier %s\n", argv[i]);
+      return 1;
+    }
+    numKinds++;
+  }
+  if (numKinds == 0)
+    for (numKinds = 0; numKinds < BARRIER_KINDS; numKinds++)
+      kinds[numKinds] = numKinds;
+
+  printf("barrier,threads,cores,episodes,episodes_per_sec,ns_per_episode\n");
+  for (numThreads = 2; ; numThreads = (numThreads*2 > maxThreads && numThreads < maxThreads)
+                                      ? maxThreads : numThreads*2) {
+    for (k = 0; k < numKinds; k++) {
+      if (!barrierInit(&barrier, kinds[k], numThreads)) {
+        fprintf(stderr, "Could not set up the barrier\n");
+        return 1;
+      }
+      for (l = 1; l < numThreads; l++)
+        pthread_create(&tid[l], NULL, Worker, (void *) l);
+      Worker((void *) 0);
+      for (l = 1; l < numThreads; l++)
+        pthread_join(tid[l], NULL);
+      barrierDestroy(&barrier);
+
+      elapsed = end_time - start_time;
+      printf("%s,%d,%ld,%d,%.0f,%.1f\n", barrierNames[kinds[k]], numThreads, cores,
+             episodes, episodes / elapsed, 1e9 * elapsed / episodes);
+      fflush(stdout);
+    }
+    if (numThreads >= maxThreads) break;
+  }
+  return 0;
+}
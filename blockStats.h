@@ -0,0 +1,186 @@
+/* sum, min and max of a matrix kept up to date under updates
+
+   The matrix is cut into blocks of one row and up to BLOCKSTATS_COLS
+   columns, numbered in row-major order. Each block has a summary (sum,
+   and min and max with their positions), and the summaries sit at the
+   leaves of a complete binary tree whose every node holds the summary
+   of the blocks below it, so the root holds the statistics of the whole
+   matrix. Since the left child always covers earlier elements than the
+   right one, ties go to the first occurrence, as in a full scan.
+
+   After changing elements, mark their blocks with blockStatsMark (or a
+   whole row with blockStatsMarkRow), recompute the marked blocks with
+   blockStatsRefreshLeaves, which several threads can do at once on
+   disjoint ranges of bs->dirtyLeaves, and then let one thread call
+   blockStatsRefreshTree. Only the blocks marked and their ancestors are
+   touched: a single cell costs one block and log2(blocks) nodes.
+
+*/
+#ifndef BLOCKSTATS_H
+#define BLOCKSTATS_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include "rowKernel.h"
+#include "matrixBuffer.h"
+
+#define BLOCKSTATS_COLS 1024 /* columns per block */
+
+typedef struct {
+  long long sum;
+  int maxValue, maxRow, maxCol;
+  int minValue, minRow, minCol;
+  int empty;            /* covers no elements */
+} blockSummary;
+
+typedef struct {
+  int rows, cols;
+  int blocksPerRow, leaves;
+  int base;             /* leaf i is node base + i; node 1 is the root */
+  blockSummary *node;   /* 2 * base nodes, node 0 unused */
+  unsigned char *dirty; /* per node: marked for recomputation */
+  int *dirtyLeaves;     /* the marked leaves, as node numbers */
+  int numDirty;
+} blockStats;
+
+/* Set up the tree for a rows x cols matrix, without computing anything.
+   Returns false if there is no memory */
+static inline bool blockStatsInit(blockStats *bs, int rows, int cols) {
+  int i;
+
+  bs->rows = rows;
+  bs->cols = cols;
+  bs->blocksPerRow = (cols + BLOCKSTATS_COLS - 1) / BLOCKSTATS_COLS;
+  bs->leaves = rows * bs->blocksPerRow;
+  for (bs->base = 1; bs->base < bs->leaves; bs->base *= 2)
+    ;
+  bs->node = malloc(2 * (size_t) bs->base * sizeof(blockSummary));
+  bs->dirty = calloc(2 * (size_t) bs->base, 1);
+  bs->dirtyLeaves = malloc((size_t) bs->leaves * sizeof(int));
+  bs->numDirty = 0;
+  if (bs->node == NULL || bs->dirty == NULL || bs->dirtyLeaves == NULL) return false;
+  for (i = bs->leaves; i < bs->base; i++)
+    bs->node[bs->base + i].empty = 1;
+  return true;
+}
+
+static inline void blockStatsFree(blockStats *bs) {
+  free(bs->node);
+  free(bs->dirty);
+  free(bs->dirtyLeaves);
+  bs->node = NULL;
+  bs->dirty = NULL;
+  bs->dirtyLeaves = NULL;
+}
+
+/* out = the summary of a followed by b */
+static inline void blockStatsCombine(blockSummary *out, const blockSummary *a, const blockSummary *b) {
+  if (b->empty) { *out = *a; return; }
+  if (a->empty) { *out = *b; return; }
+  *out = *a;
+  out->sum += b->sum;
+  if (out->maxValue < b->maxValue) {
+    out->maxValue = b->maxValue;
+    out->maxRow = b->maxRow;
+    out->maxCol = b->maxCol;
+  }
+  if (out->minValue > b->minValue) {
+    out->minValue = b->minValue;
+    out->minRow = b->minRow;
+    out->minCol = b->minCol;
+  }
+}
+
+/* recompute the summary of leaf node from the matrix */
+static inline void blockStatsLeaf(blockStats *bs, const matrixBuffer *m, int node) {
+  int leaf = node - bs->base;
+  int i = leaf / bs->blocksPerRow;
+  int j = leaf % bs->blocksPerRow * BLOCKSTATS_COLS;
+  int n = (bs->cols - j < BLOCKSTATS_COLS) ? bs->cols - j : BLOCKSTATS_COLS;
+  blockSummary *s = &bs->node[node];
+  rowStats row;
+
+  rowReduce(matrixRow(m, i) + j, n, &row);
+  s->sum = row.sum;
+  s->maxValue = row.maxValue;
+  s->maxRow = i;
+  s->maxCol = j + row.maxj;
+  s->minValue = row.minValue;
+  s->minRow = i;
+  s->minCol = j + row.minj;
+  s->empty = 0;
+}
+
+/* compute the leaves of rows first..last, for building the tree */
+static inline void blockStatsBuildRows(blockStats *bs, const matrixBuffer *m, int first, int last) {
+  int node;
+
+  for (node = bs->base + first * bs->blocksPerRow;
+       node < bs->base + (last + 1) * bs->blocksPerRow; node++)
+    blockStatsLeaf(bs, m, node);
+}
+
+/* compute every inner node, once all leaves are computed */
+static inline void blockStatsBuildTree(blockStats *bs) {
+  int node;
+
+  for (node = bs->base - 1; node >= 1; node--)
+    blockStatsCombine(&bs->node[node], &bs->node[2*node], &bs->node[2*node + 1]);
+}
+
+/* mark the block holding element (i, j) */
+static inline void blockStatsMark(blockStats *bs, int i, int j) {
+  int node = bs->base + i * bs->blocksPerRow + j / BLOCKSTATS_COLS;
+
+  if (!bs->dirty[node]) {
+    bs->dirty[node] = 1;
+    bs->dirtyLeaves[bs->numDirty++] = node;
+  }
+}
+
+/* mark every block of row i */
+static inline void blockStatsMarkRow(blockStats *bs, int i) {
+  int j;
+
+  for (j = 0; j < bs->cols; j += BLOCKSTATS_COLS)
+    blockStatsMark(bs, i, j);
+}
+
+/* recompute the marked leaves dirtyLeaves[first..last] */
+static inline void blockStatsRefreshLeaves(blockStats *bs, const matrixBuffer *m, int first, int last) {
+  int k;
+
+  for (k = first; k <= last; k++)
+    blockStatsLeaf(bs, m, bs->dirtyLeaves[k]);
+}
+
+/* Recompute the ancestors of the marked leaves, a level at a time, and
+   clear the marks. All leaves are on the same level, so every node is
+   recomputed after both of its children */
+static inline void blockStatsRefreshTree(blockStats *bs) {
+  int *list = bs->dirtyLeaves;
+  int n = bs->numDirty, k, next, parent;
+
+  while (n > 0) {
+    next = 0;
+    for (k = 0; k < n; k++) {
+      bs->dirty[list[k]] = 0;
+      parent = list[k] / 2;
+      if (parent >= 1 && !bs->dirty[parent]) {
+        bs->dirty[parent] = 1;
+        list[next++] = parent; /* next <= k, so list[k] has been read */
+      }
+    }
+    for (k = 0; k < next; k++)
+      blockStatsCombine(&bs->node[list[k]], &bs->node[2*list[k]], &bs->node[2*list[k] + 1]);
+    n = next;
+  }
+  bs->numDirty = 0;
+}
+
+/* the statistics of the whole matrix */
+static inline const blockSummary *blockStatsTotal(const blockStats *bs) {
+  return &bs->node[1];
+}
+
+#endif /* BLOCKSTATS_H */
@@ -0,0 +1,24 @@
+/* counter-based random numbers
+
+   counterRng(seed, row, col) is a pure function of its arguments: the
+   SplitMix64 output for position row*2^32 + col of the stream selected
+   by seed. Any thread can generate any element without sharing state,
+   so a matrix filled by several threads is the same for a given seed
+   no matter how the rows are divided between them.
+
+*/
+#ifndef COUNTERRNG_H
+#define COUNTERRNG_H
+
+#include <stdint.h>
+
+static inline uint64_t counterRng(uint64_t seed, uint64_t row, uint64_t col) {
+  uint64_t z = (seed << 1 | 1) * 0xD1B54A32D192ED03ULL
+             + ((row << 32 | col) + 1) * 0x9E3779B97F4A7C15ULL;
+
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+#endif /* COUNTERRNG_H */
@@ -0,0 +1,246 @@
+/* sparse matrices of ints in compressed sparse row (CSR) form
+
+   Row i holds the nonzeros values[rowPtr[i] .. rowPtr[i+1]-1], in
+   columns colIdx[] of the same range, sorted by column and without
+   repeats. Every other element is an implicit zero.
+
+   csrLoadMatrixMarket reads a coordinate Matrix Market file (integer,
+   real or pattern; general, symmetric or skew-symmetric), rounding
+   real values to ints, adding up repeated entries and filling in the
+   other half of symmetric matrices. csrGenerateRows makes a random
+   matrix of a given density from counterRng, row by row, so that
+   workers can build their own rows (first counting, then filling once
+   rowPtr is summed up).
+
+   csrFirstRow splits the rows between workers by nonzeros rather than by
+   rows: worker w starts at the first row whose nonzeros begin at or
+   after w/numWorkers of them.
+
+*/
+#ifndef CSRMATRIX_H
+#define CSRMATRIX_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include "counterRng.h"
+
+typedef struct {
+  int rows, cols;
+  long long nnz;
+  long long *rowPtr; /* rows + 1 offsets into colIdx and values */
+  int *colIdx;
+  int *values;
+} csrMatrix;
+
+/* Allocate rowPtr for rows x cols, with no nonzeros yet.
+   Returns false if there is no memory */
+static inline bool csrAllocRows(csrMatrix *m, int rows, int cols) {
+  m->rows = rows;
+  m->cols = cols;
+  m->nnz = 0;
+  m->rowPtr = calloc((size_t) rows + 1, sizeof(long long));
+  m->colIdx = NULL;
+  m->values = NULL;
+  return m->rowPtr != NULL;
+}
+
+/* Turn the counts in rowPtr[1..rows] into offsets and allocate the
+   nonzeros. Returns false if there is no memory */
+static inline bool csrAllocNonzeros(csrMatrix *m) {
+  int i;
+
+  m->rowPtr[0] = 0;
+  for (i = 0; i < m->rows; i++)
+    m->rowPtr[i + 1] += m->rowPtr[i];
+  m->nnz = m->rowPtr[m->rows];
+  m->colIdx = malloc((m->nnz > 0 ? m->nnz : 1) * sizeof(int));
+  m->values = malloc((m->nnz > 0 ? m->nnz : 1) * sizeof(int));
+  return m->colIdx != NULL && m->values != NULL;
+}
+
+static inline void csrFree(csrMatrix *m) {
+  free(m->rowPtr);
+  free(m->colIdx);
+  free(m->values);
+  m->rowPtr = NULL;
+  m->colIdx = NULL;
+  m->values = NULL;
+}
+
+/* Random rows first..last with about density * cols nonzeros each,
+   valued 1..1000. Columns are picked by geometric skips, so a row costs
+   its nonzeros rather than cols. Without fill, stores the count of row
+   i in rowPtr[i+1]; with fill, stores the nonzeros themselves */
+static inline void csrGenerateRows(csrMatrix *m, int first, int last, double density,
+                                   uint64_t seed, bool fill) {
+  double logq = (density < 1) ? log(1 - density) : 0, u;
+  long long k;
+  int i, j, n;
+  uint64_t r;
+
+  for (i = first; i <= last; i++) {
+    k = fill ? m->rowPtr[i] : 0;
+    for (j = -1, n = 0; ; n++) {
+      /* skip a geometric number of zeros */
+      r = counterRng(seed, (uint64_t) i, (uint64_t) n);
+      if (density >= 1)
+        j++;
+      else if (density <= 0)
+        j = m->cols;
+      else {
+        u = ((r >> 11) + 1) * (1.0 / 9007199254740993.0);
+        j += 1 + (int) fmin(floor(log(u) / logq), (double) m->cols);
+      }
+      if (j >= m->cols) break;
+      if (fill) {
+        m->colIdx[k] = j;
+        r = counterRng(~seed, (uint64_t) i, (uint64_t) n);
+        m->values[k] = 1 + (int) (((r >> 32) * 1000) >> 32);
+        k++;
+      }
+    }
+    if (!fill) m->rowPtr[i + 1] = n;
+  }
+}
+
+/* first row of worker w, balancing the nonzeros; row rows past the last */
+static inline int csrFirstRow(const csrMatrix *m, int w, int numWorkers) {
+  long long target = m->nnz * w / numWorkers;
+  int lo = 0, hi = m->rows, mid;
+
+  if (w == 0) return 0;
+  if (w >= numWorkers) return m->rows;
+  /* smallest row whose nonzeros start at or after target */
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (m->rowPtr[mid] < target) lo = mid + 1; else hi = mid;
+  }
+  return lo;
+}
+
+/* one entry read from a file */
+typedef struct {
+  int row, col, value;
+} csrEntry;
+
+static int csrCompareEntries(const void *a, const void *b) {
+  const csrEntry *x = a, *y = b;
+
+  if (x->row != y->row) return (x->row > y->row) - (x->row < y->row);
+  return (x->col > y->col) - (x->col < y->col);
+}
+
+/* Read a coordinate Matrix Market file into m. Prints a message and
+   returns false on failure */
+static inline bool csrLoadMatrixMarket(const char *path, csrMatrix *m) {
+  FILE *f = fopen(path, "r");
+  char line[1024], object[64], format[64], field[64], symmetry[64];
+  long long n, k, i, entries;
+  int rows, cols, r, c, sign;
+  double value;
+  csrEntry *e;
+  bool pattern, symmetric, skew;
+
+  if (f == NULL) {
+    perror(path);
+    return false;
+  }
+  if (fgets(line, sizeof(line), f) == NULL
+      || sscanf(line, "%%%%MatrixMarket %63s %63s %63s %63s", object, format, field, symmetry) != 4
+      || strcmp(object, "matrix") != 0 || strcmp(format, "coordinate") != 0
+      || strcmp(field, "complex") == 0) {
+    fprintf(stderr, "%s is not a coordinate Matrix Market matrix\n", path);
+    fclose(f);
+    return false;
+  }
+  pattern = strcmp(field, "pattern") == 0;
+  symmetric = strcmp(symmetry, "general") != 0;
+  skew = strcmp(symmetry, "skew-symmetric") == 0;
+  do {
+    if (fgets(line, sizeof(line), f) == NULL) line[0] = '\0';
+  } while (line[0] == '%');
+  if (sscanf(line, "%d %d %lld", &rows, &cols, &entries) != 3 || rows < 1 || cols < 1 || entries < 0) {
+    fprintf(stderr, "%s has no size line\n", path);
+    fclose(f);
+    return false;
+  }
+
+  e = malloc(((symmetric ? 2 : 1) * entries + 1) * sizeof(csrEntry));
+  if (e == NULL) {
+    fprintf(stderr, "Could not allocate %lld entries\n", entries);
+    fclose(f);
+    return false;
+  }
+  for (n = 0, k = 0; k < entries; k++) {
+    value = 1;
+    if (fscanf(f, "%d %d", &r, &c) != 2 || (!pattern && fscanf(f, "%lf", &value) != 1)
+        || r < 1 || r > rows || c < 1 || c > cols) {
+      fprintf(stderr, "%s: bad entry %lld\n", path, k + 1);
+      free(e);
+      fclose(f);
+      return false;
+    }
+    e[n].row = r - 1;
+    e[n].col = c - 1;
+    e[n].value = (int) lround(value);
+    n++;
+    if (symmetric && r != c) {
+      sign = skew ? -1 : 1;
+      e[n].row = c - 1;
+      e[n].col = r - 1;
+      e[n].value = sign * (int) lround(value);
+      n++;
+    }
+  }
+  fclose(f);
+
+  /* sort by position and add up repeats */
+  qsort(e, n, sizeof(csrEntry), csrCompareEntries);
+  for (i = 0, k = 0; k < n; k++) {
+    if (i > 0 && e[i-1].row == e[k].row && e[i-1].col == e[k].col)
+      e[i-1].value += e[k].value;
+    else
+      e[i++] = e[k];
+  }
+  n = i;
+
+  if (!csrAllocRows(m, rows, cols)) {
+    free(e);
+    return false;
+  }
+  for (k = 0; k < n; k++)
+    m->rowPtr[e[k].row + 1]++;
+  if (!csrAllocNonzeros(m)) {
+    free(e);
+    return false;
+  }
+  for (k = 0; k < n; k++) {
+    m->colIdx[k] = e[k].col;
+    m->values[k] = e[k].value;
+  }
+  free(e);
+  return true;
+}
+
+/* Write m as a coordinate integer Matrix Market file. Returns false on failure */
+static inline bool csrWriteMatrixMarket(const char *path, const csrMatrix *m) {
+  FILE *f = fopen(path, "w");
+  long long k;
+  int i;
+
+  if (f == NULL) {
+    perror(path);
+    return false;
+  }
+  fprintf(f, "%%%%MatrixMarket matrix coordinate integer general\n");
+  fprintf(f, "%d %d %lld\n", m->rows, m->cols, m->nnz);
+  for (i = 0; i < m->rows; i++)
+    for (k = m->rowPtr[i]; k < m->rowPtr[i + 1]; k++)
+      fprintf(f, "%d %d %d\n", i + 1, m->colIdx[k] + 1, m->values[k]);
+  return fclose(f) == 0;
+}
+
+#endif /* CSRMATRIX_H */
@@ -0,0 +1,455 @@
+/* external merge sort of a binary file of ints
+
+   externalSort reads the input in runs of as many ints as fit in the
+   memory it is given, sorts each run with the in-memory sort it is
+   passed, and writes the runs one after the other to a temporary file.
+   Then it merges all the runs in one pass with a loser tree: the tree
+   holds the loser of every match, so finding the next smallest key
+   after the winner is replaced costs one comparison per level, log2 k
+   for k runs.
+
+   All the I/O of the merge goes through one I/O thread, in blocks as
+   large as the memory allows (up to EXT_BLOCK ints). Every run has two
+   blocks: while the merge consumes one, the I/O thread reads the next
+   block of the run into the other, and the output is double-buffered
+   the same way. So the disk sees large sequential transfers, and the
+   merge waits for it only when it is faster than the disk.
+
+   The merge checks its output as it writes it: that it is sorted, and
+   that it has the count, sum and sum of squares (mod 2^64) of the input.
+
+   Memory: a run and the scratch of the sort share the memory given, so
+   a sort that needs a second buffer as large as the run gets runs of
+   half the size. The merge splits the same memory into its 2(k+1)
+   blocks, but never makes them smaller than EXT_MINBLOCK ints, below
+   which the disk spends its time seeking; so past memory / (2
+   EXT_MINBLOCK) - 1 runs (7 runs of 1 MB, 2047 of 256 MB) the merge
+   takes 2(k+1) EXT_MINBLOCK ints instead, and says so.
+
+*/
+#ifndef EXTERNALSORT_H
+#define EXTERNALSORT_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#define EXT_BLOCK (1L << 20)      /* largest I/O block in ints: 4 MB */
+#define EXT_MINBLOCK (16L << 10)  /* smallest, whatever the memory */
+
+/* a read or write for the I/O thread */
+typedef struct extRequest {
+  int fd;
+  bool write;
+  void *buf;
+  size_t bytes;
+  off_t offset;
+  ssize_t result;  /* bytes transferred, -1 on error */
+  bool done;
+  struct extRequest *next;
+} extRequest;
+
+/* the I/O thread and its queue of requests */
+typedef struct {
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t work, done;
+  extRequest *head, *tail;
+  bool stop;
+} extIo;
+
+/* one run being merged */
+typedef struct {
+  int *buf[2];         /* the block being merged and the next one */
+  extRequest req[2];
+  int cur;             /* which of buf is being merged */
+  long pos, len;       /* next key and keys in buf[cur] */
+  off_t next, end;     /* next block to read and end of the run, in bytes */
+} extRun;
+
+/* what externalSort did */
+typedef struct {
+  long long count;
+  int runs;
+  double runSeconds, mergeSeconds;
+  bool sorted, sameKeys;  /* the checks of the output */
+} extStats;
+
+/* sums of the keys, to check that the output holds the input's keys */
+typedef struct {
+  long long count;
+  uint64_t sum, squares;
+} extSums;
+
+static inline void extAdd(extSums *s, const int *a, long n) {
+  long i;
+
+  s->count += n;
+  for (i = 0; i < n; i++) {
+    s->sum += (uint64_t) (int64_t) a[i];
+    s->squares += (uint64_t) ((int64_t) a[i] * a[i]);
+  }
+}
+
+/* transfer all of bytes at offset; returns the bytes done, -1 on error */
+static inline ssize_t extTransfer(int fd, bool write, void *buf, size_t bytes, off_t offset) {
+  size_t done = 0;
+  ssize_t n;
+
+  while (done < bytes) {
+    n = write ? pwrite(fd, (char *) buf + done, bytes - done, offset + done)
+              : pread(fd, (char *) buf + done, bytes - done, offset + done);
+    if (n < 0) return -1;
+    if (n == 0) break;
+    done += n;
+  }
+  return done;
+}
+
+static void *extIoThread(void *arg) {
+  extIo *io = arg;
+  extRequest *r;
+
+  pthread_mutex_lock(&io->lock);
+  while (true) {
+    while (io->head == NULL && !io->stop)
+      pthread_cond_wait(&io->work, &io->lock);
+    if (io->head == NULL) break;
+    r = io->head;
+    io->head = r->next;
+    if (io->head == NULL) io->tail = NULL;
+    pthread_mutex_unlock(&io->lock);
+    r->result = extTransfer(r->fd, r->write, r->buf, r->bytes, r->offset);
+    pthread_mutex_lock(&io->lock);
+    r->done = true;
+    pthread_cond_broadcast(&io->done);
+  }
+  pthread_mutex_unlock(&io->lock);
+  return NULL;
+}
+
+static inline bool extIoStart(extIo *io) {
+  io->head = io->tail = NULL;
+  io->stop = false;
+  pthread_mutex_init(&io->lock, NULL);
+  pthread_cond_init(&io->work, NULL);
+  pthread_cond_init(&io->done, NULL);
+  return pthread_create(&io->thread, NULL, extIoThread, io) == 0;
+}
+
+/* finish the queued requests and stop the thread */
+static inline void extIoStop(extIo *io) {
+  pthread_mutex_lock(&io->lock);
+  io->stop = true;
+  pthread_cond_signal(&io->work);
+  pthread_mutex_unlock(&io->lock);
+  pthread_join(io->thread, NULL);
+  pthread_mutex_destroy(&io->lock);
+  pthread_cond_destroy(&io->work);
+  pthread_cond_destroy(&io->done);
+}
+
+/* queue r, a transfer of bytes at offset of fd */
+static inline void extIoPost(extIo *io, extRequest *r, int fd, bool write, void *buf,
+                             size_t bytes, off_t offset) {
+  r->fd = fd;
+  r->write = write;
+  r->buf = buf;
+  r->bytes = bytes;
+  r->offset = offset;
+  r->done = false;
+  r->next = NULL;
+  pthread_mutex_lock(&io->lock);
+  if (io->tail == NULL) io->head = r; else io->tail->next = r;
+  io->tail = r;
+  pthread_cond_signal(&io->work);
+  pthread_mutex_unlock(&io->lock);
+}
+
+/* wait for r; returns the bytes it transferred, -1 on error */
+static inline ssize_t extIoWait(extIo *io, extRequest *r) {
+  pthread_mutex_lock(&io->lock);
+  while (!r->done)
+    pthread_cond_wait(&io->done, &io->lock);
+  pthread_mutex_unlock(&io->lock);
+  return r->result;
+}
+
+/* start reading the next block of run r into buf[b], if there is one */
+static inline void extRunFetch(extIo *io, extRun *r, int fd, int b, long blockInts) {
+  size_t bytes = blockInts * sizeof(int);
+
+  if (r->end - r->next < (off_t) bytes) bytes = r->end - r->next;
+  if (bytes == 0) {
+    r->req[b].result = 0;
+    r->req[b].done = true;
+    return;
+  }
+  extIoPost(io, &r->req[b], fd, false, r->buf[b], bytes, r->next);
+  r->next += bytes;
+}
+
+/* move r to its next block once the current one is used up; len is 0
+   when the run is exhausted. Returns false on a read error */
+static inline bool extRunAdvance(extIo *io, extRun *r, int fd, long blockInts) {
+  ssize_t n;
+
+  if (r->pos < r->len) return true;
+  n = extIoWait(io, &r->req[1 - r->cur]);
+  if (n < 0) return false;
+  r->cur = 1 - r->cur;
+  r->pos = 0;
+  r->len = n / sizeof(int);
+  if (r->len > 0) extRunFetch(io, r, fd, 1 - r->cur, blockInts);
+  return true;
+}
+
+/* does run a come before run b: an exhausted run never does, and equal
+   keys go in run order */
+static inline bool extBeats(const extRun *runs, int a, int b) {
+  const extRun *x = &runs[a], *y = &runs[b];
+
+  if (x->pos >= x->len) return false;
+  if (y->pos >= y->len) return true;
+  if (x->buf[x->cur][x->pos] != y->buf[y->cur][y->pos])
+    return x->buf[x->cur][x->pos] < y->buf[y->cur][y->pos];
+  return a < b;
+}
+
+/* Build the loser tree of k runs: tree[1..k-1] hold the losers of the
+   matches, with the parent of node or leaf i at (i + k) / 2 for leaves,
+   i / 2 for nodes, and tree[0] the overall winner */
+static inline void extTreeBuild(int *tree, int k, const extRun *runs) {
+  int i, node, winner, t;
+
+  for (i = 0; i < k; i++)
+    tree[i] = -1;
+  for (i = 0; i < k; i++) {
+    winner = i;
+    for (node = (i + k) / 2; node > 0; node /= 2) {
+      if (tree[node] < 0) {
+        /* the other side of this match is not in yet */
+        tree[node] = winner;
+        winner = -1;
+        break;
+      }
+      if (extBeats(runs, tree[node], winner)) {
+        t = tree[node];
+        tree[node] = winner;
+        winner = t;
+      }
+    }
+    if (winner >= 0) tree[0] = winner;
+  }
+}
+
+/* replay the matches of run w, whose head has changed, up to the root */
+static inline void extTreeReplay(int *tree, int k, const extRun *runs, int w) {
+  int node, t;
+
+  for (node = (w + k) / 2; node > 0; node /= 2)
+    if (extBeats(runs, tree[node], w)) {
+      t = tree[node];
+      tree[node] = w;
+      w = t;
+    }
+  tree[0] = w;
+}
+
+/* Sort the ints of the file at in, which must hold a whole number of
+   them, into the file at out in about memoryInts of memory (see the
+   top of the file); runs are sorted by sort, which takes scratch ints
+   of its own for every key (0 in place, 1 with a second buffer), and
+   kept in a temporary file in tmpdir.
+   Prints what went wrong and returns false on failure */
+static inline bool externalSort(const char *in, const char *out, const char *tmpdir,
+                                long memoryInts, void (*sort)(int *, int), int scratch,
+                                double (*timer)(void), extStats *stats) {
+  char tmpPath[4096];
+  int inFd, outFd, tmpFd, k, i, w, *a, *tree = NULL, *outBuf[2] = { NULL, NULL }, ob = 0;
+  long n, runInts, blockInts, outLen = 0, j;
+  off_t offset = 0, outOffset = 0, *runStart = NULL, *more;
+  ssize_t got;
+  extRun *runs = NULL;
+  extRequest outReq[2];
+  extIo io;
+  struct stat st;
+  extSums input = { 0, 0, 0 }, output = { 0, 0, 0 };
+  bool ok = true, started = false;
+  int previous = 0;
+  double t;
+
+  memset(stats, 0, sizeof(*stats));
+  stats->sorted = true;
+  runInts = memoryInts / (1 + scratch);
+  if (runInts < 1) runInts = 1;
+  if (runInts > 0x7fffffffL) runInts = 0x7fffffffL; /* sort takes an int count */
+  inFd = open(in, O_RDONLY);
+  if (inFd < 0) {
+    perror(in);
+    return false;
+  }
+  if (fstat(inFd, &st) != 0) {
+    perror(in);
+    close(inFd);
+    return false;
+  }
+  if (st.st_size % sizeof(int) != 0) {
+    fprintf(stderr, "%s holds %lld bytes, not a whole number of ints\n", in, (long long) st.st_size);
+    close(inFd);
+    return false;
+  }
+  outFd = open(out, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (outFd < 0) {
+    perror(out);
+    close(inFd);
+    return false;
+  }
+  snprintf(tmpPath, sizeof(tmpPath), "%s/sortrunsXXXXXX", tmpdir);
+  tmpFd = mkstemp(tmpPath);
+  if (tmpFd < 0) {
+    perror(tmpPath);
+    close(inFd);
+    close(outFd);
+    return false;
+  }
+  unlink(tmpPath); /* gone once it is closed */
+  a = malloc(runInts * sizeof(int));
+  if (a == NULL) {
+    fprintf(stderr, "Could not allocate a run of %ld ints\n", runInts);
+    ok = false;
+  }
+
+  /* make the sorted runs */
+  t = timer();
+  for (k = 0; ok; k++) {
+    got = extTransfer(inFd, false, a, runInts * sizeof(int), offset);
+    if (got < 0) {
+      perror(in);
+      ok = false;
+      break;
+    }
+    n = got / sizeof(int);
+    if (n == 0) break;
+    more = realloc(runStart, (k + 2) * sizeof(off_t));
+    if (more == NULL) {
+      fprintf(stderr, "Could not allocate %d runs\n", k + 1);
+      ok = false;
+      break;
+    }
+    runStart = more;
+    runStart[k] = offset;
+    extAdd(&input, a, n);
+    sort(a, (int) n);
+    if (extTransfer(tmpFd, true, a, n * sizeof(int), offset) != (ssize_t) (n * sizeof(int))) {
+      perror("run file");
+      ok = false;
+      break;
+    }
+    offset += n * sizeof(int);
+    runStart[k + 1] = offset;
+  }
+  free(a);
+  stats->runs = k;
+  stats->runSeconds = timer() - t;
+
+  /* merge them: two blocks for each run and two for the output */
+  t = timer();
+  if (ok && k > 0) {
+    blockInts = memoryInts / (2 * (k + 1));
+    if (blockInts > EXT_BLOCK) blockInts = EXT_BLOCK;
+    if (blockInts < EXT_MINBLOCK) {
+      blockInts = EXT_MINBLOCK;
+      fprintf(stderr, "Merging %d runs takes %ld ints of buffers, more than the %ld given\n",
+              k, 2 * (k + 1) * blockInts, memoryInts);
+    }
+    runs = calloc(k, sizeof(extRun));
+    tree = malloc(k * sizeof(int));
+    outBuf[0] = malloc(blockInts * sizeof(int));
+    outBuf[1] = malloc(blockInts * sizeof(int));
+    ok = runs != NULL && tree != NULL && outBuf[0] != NULL && outBuf[1] != NULL;
+    for (i = 0; ok && i < k; i++) {
+      runs[i].buf[0] = malloc(blockInts * sizeof(int));
+      runs[i].buf[1] = malloc(blockInts * sizeof(int));
+      ok = runs[i].buf[0] != NULL && runs[i].buf[1] != NULL;
+    }
+    if (!ok) fprintf(stderr, "Could not allocate the buffers to merge %d runs\n", k);
+    if (ok && !(started = extIoStart(&io))) {
+      fprintf(stderr, "Could not start the I/O thread of the merge\n");
+      ok = false;
+    }
+
+    /* read the first block of every run and start on the second */
+    for (i = 0; ok && i < k; i++) {
+      runs[i].next = runStart[i];
+      runs[i].end = runStart[i + 1];
+      runs[i].cur = 1;
+      extRunFetch(&io, &runs[i], tmpFd, 0, blockInts);
+      ok = extRunAdvance(&io, &runs[i], tmpFd, blockInts);
+    }
+    if (ok) extTreeBuild(tree, k, runs);
+    outReq[0].done = outReq[1].done = true;
+    outReq[0].result = outReq[1].result = 0;
+
+    while (ok) {
+      w = tree[0];
+      if (runs[w].pos >= runs[w].len) break; /* every run is exhausted */
+      j = outLen++;
+      outBuf[ob][j] = runs[w].buf[runs[w].cur][runs[w].pos++];
+      if (output.count + j > 0 && outBuf[ob][j] < previous) stats->sorted = false;
+      previous = outBuf[ob][j];
+      if (outLen == blockInts) {
+        /* hand the full block to the I/O thread and fill the other */
+        extAdd(&output, outBuf[ob], outLen);
+        extIoPost(&io, &outReq[ob], outFd, true, outBuf[ob], outLen * sizeof(int), outOffset);
+        outOffset += outLen * sizeof(int);
+        ob = 1 - ob;
+        outLen = 0;
+        ok = extIoWait(&io, &outReq[ob]) >= 0;
+      }
+      ok = ok && extRunAdvance(&io, &runs[w], tmpFd, blockInts);
+      extTreeReplay(tree, k, runs, w);
+    }
+    if (ok && outLen > 0) {
+      extAdd(&output, outBuf[ob], outLen);
+      ok = extTransfer(outFd, true, outBuf[ob], outLen * sizeof(int), outOffset)
+           == (ssize_t) (outLen * sizeof(int));
+    }
+    if (started) {
+      ok = extIoWait(&io, &outReq[1 - ob]) >= 0 && ok;
+      /* reads still queued for the runs are finished before stopping */
+      extIoStop(&io);
+    }
+    if (!ok && started) fprintf(stderr, "Could not merge the runs into %s\n", out);
+  }
+  stats->mergeSeconds = timer() - t;
+  stats->count = output.count;
+  stats->sameKeys = input.count == output.count && input.sum == output.sum
+                    && input.squares == output.squares;
+
+  for (i = 0; runs != NULL && i < k; i++) {
+    free(runs[i].buf[0]);
+    free(runs[i].buf[1]);
+  }
+  free(runs);
+  free(tree);
+  free(outBuf[0]);
+  free(outBuf[1]);
+  free(runStart);
+  close(inFd);
+  close(tmpFd);
+  if (close(outFd) != 0) ok = false;
+  return ok;
+}
+
+#endif /* EXTERNALSORT_H */
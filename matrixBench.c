@@ -0,0 +1,482 @@
+/* benchmark of the matrix summation strategies
+
+   features: runs every reduction strategy of the matrixSum programs
+             over a sweep of matrix sizes and worker counts in one
+             process; for each combination the workers are created once,
+             fill the matrix, and then reduce it warmup untimed times and
+             trials timed times per strategy. Prints the median, 95th
+             percentile and best time of the trials, and the bandwidth at
+             the median, as CSV. Exits with 1 if two strategies disagree
+             on the results
+
+   strategies:
+     strip     strips, partial results in shared arrays, a barrier and
+               Worker[0] combines them (matrixSum.c)
+     tree      strips, padded partial results combined in pairs
+               (matrixSumA.c)
+     locked    strips, each worker publishes under mutexes
+               (matrixSumB.c sink=locked)
+     lockfree  strips, each worker publishes through the lock-free
+               sink (matrixSumB.c)
+     bag       one row per lock from a bag of tasks (matrixSumC.c mutex)
+     guided    chunks of rows from the guided dispenser (matrixSumC.c)
+
+   usage under Linux:
+     gcc -O2 matrixBench.c -lpthread
+     a.out [sizes=N,N,...] [workers=N,N,...] [strategies=NAME,...]
+       [trials=N] [warmup=N] [kernel=avx512|avx2|scalar] [huge] [pin]
+       [seed=N] [barrier=KIND]
+
+     sizes default to 1000,4000,10000; workers to 1, 2, 4, ... up
+     to the number of cores; trials to 10 and warmup to 2
+
+*/
+#ifndef _REENTRANT
+#define _REENTRANT
+#endif
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <sched.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "rowKernel.h"
+#include "matrixBuffer.h"
+#include "barrier.h"
+#include "resultSink.h"
+#define MAXWORKERS 64      /* maximum number of workers */
+#define MAXSWEEP 32        /* most sizes or worker counts in a sweep */
+
+#define STRIP 0
+#define TREE 1
+#define LOCKED 2
+#define LOCKFREE 3
+#define BAG 4
+#define GUIDED 5
+#define STRATEGIES 6
+
+const char *strategyNames[STRATEGIES] = { "strip", "tree", "locked", "lockfree", "bag", "guided" };
+
+/* the results of a reduction, or of part of one */
+typedef struct {
+  long long sum;
+  int maxValue, maxi, maxj;
+  int minValue, mini, minj;
+} reduction;
+
+/* tree: one worker's partial results on cache lines of their own */
+typedef struct {
+  _Alignas(CACHELINE) reduction r;
+  atomic_int ready; /* set once this holds the results of its subtree */
+} partialResult;
+
+barrierState barrier;     /* the barrier, of the kind chosen at startup */
+int barrierKindUsed = BARRIER_MUTEX; /* see barrier.h */
+int numWorkers;           /* workers in the current pool */
+
+/* a reusable barrier; myid is the caller's worker number */
+void Barrier(long myid) {
+  barrierWait(&barrier, myid);
+}
+
+/* monotonic timer */
+double read_timer() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + 1.0e-9 * t.tv_nsec;
+}
+
+int size, stripSize;      /* the current matrix and its strips */
+matrixBuffer matrix;
+bool fillMatrix;          /* the pool still has to fill the matrix */
+bool pinWorkers = false;  /* pin each worker to one CPU */
+uint64_t seed = 1;        /* selects the random matrix */
+
+int strategies[STRATEGIES], numStrategies; /* strategies to run */
+int trials = 10, warmup = 2;
+double *times;            /* of the timed trials of one strategy */
+reduction expected;       /* results of the first strategy on this matrix */
+bool haveExpected, mismatch;
+
+double starts[MAXWORKERS];  /* when each worker began the current trial */
+
+/* state of the strategies, reset by Worker[0] before every trial */
+reduction parts[MAXWORKERS];         /* strip */
+partialResult partials[MAXWORKERS];  /* tree */
+resultSink sink;                     /* locked, lockfree, bag, guided */
+pthread_mutex_t bagLock;
+int bagOfTasks;                      /* bag: next row */
+atomic_int nextRow;                  /* guided: first row not handed out */
+
+void *Worker(void *);
+
+/* Parse a comma separated list of at most MAXSWEEP positive ints.
+   Returns how many there were, 0 if one was bad */
+int parseList(const char *s, int *list) {
+  int n = 0;
+  char *end;
+
+  while (n < MAXSWEEP) {
+    list[n] = (int) strtol(s, &end, 10);
+    if (end == s || list[n] < 1) return 0;
+    n++;
+    if (*end != ',') break;
+    s = end + 1;
+  }
+  return n;
+}
+
+/* read command line and run the sweep */
+int main(int argc, char *argv[]) {
+  int sizes[MAXSWEEP], workers[MAXSWEEP], numSizes, numCounts;
+  int i, k, w;
+  bool hugePages = false;
+  const char *kernelName = NULL, *name, *end;
+  long l, cores = sysconf(_SC_NPROCESSORS_ONLN);
+  pthread_attr_t attr;
+  pthread_t workerid[MAXWORKERS];
+
+  /* set global thread attributes */
+  pthread_attr_init(&attr);
+  pthread_attr_setscope(&attr, PTHREAD_SCOPE_SYSTEM);
+  pthread_mutex_init(&bagLock, NULL);
+  sinkInit(&sink, SINK_LOCKFREE, 0);
+
+  sizes[0] = 1000;
+  sizes[1] = 4000;
+  sizes[2] = 10000;
+  numSizes = 3;
+  numCounts = 0;
+  for (w = 1; w < cores && w < MAXWORKERS && numCounts < MAXSWEEP - 1; w *= 2)
+    workers[numCounts++] = w;
+  workers[numCounts++] = (cores < MAXWORKERS) ? (int) cores : MAXWORKERS;
+  numStrategies = STRATEGIES;
+  for (k = 0; k < STRATEGIES; k++)
+    strategies[k] = k;
+
+  /* read command line args if any */
+  for (i = 1; i < argc; i++) {
+    if (strncmp(argv[i], "sizes=", 6) == 0)
+      numSizes = parseList(argv[i] + 6, sizes);
+    else if (strncmp(argv[i], "workers=", 8) == 0)
+      numCounts = parseList(argv[i] + 8, workers);
+    else if (strncmp(argv[i], "strategies=", 11) == 0) {
+      numStrategies = 0;
+      for (name = argv[i] + 11; *name != '\0'; name = (*end == ',') ? end + 1 : end) {
+        end = strchr(name, ',');
+        if (end == NULL) end = name + strlen(name);
+        for (k = 0; k < STRATEGIES; k++)
+          if ((size_t) (end - name) == strlen(strategyNames[k])
+              && strncmp(name, strategyNames[k], end - name) == 0)
+            break;
+        if (k == STRATEGIES || numStrategies == STRATEGIES) {
+          fprintf(stderr, "unknown strategy %.*s\n", (int) (end - name), name);
+          return 1;
+        }
+        strategies[numStrategies++] = k;
+      }
+    } else if (strncmp(argv[i], "trials=", 7) == 0)
+      trials = atoi(argv[i] + 7);
+    else if (strncmp(argv[i], "warmup=", 7) == 0)
+      warmup = atoi(argv[i] + 7);
+    else if (strncmp(argv[i], "kernel=", 7) == 0)
+      kernelName = argv[i] + 7;
+    else if (strcmp(argv[i], "huge") == 0)
+      hugePages = true;
+    else if (strcmp(argv[i], "pin") == 0)
+      pinWorkers = true;
+    else if (strncmp(argv[i], "seed=", 5) == 0)
+      seed = strtoull(argv[i] + 5, NULL, 10);
+    else if (strncmp(argv[i], "barrier=", 8) == 0) {
+      barrierKindUsed = barrierKind(argv[i] + 8);
+      if (barrierKindUsed < 0) {
+        fprintf(stderr, "unknown barrier %s\n", argv[i] + 8);
+        return 1;
+      }
+    }
+  }
+  if (numSizes == 0 || numCounts == 0 || numStrategies == 0) {
+    fprintf(stderr, "sizes, workers and strategies need at least one positive entry each\n");
+    return 1;
+  }
+  if (trials < 1) trials = 1;
+  if (warmup < 0) warmup = 0;
+  rowKernelInit(kernelName);
+  times = malloc(trials * sizeof(double));
+  if (times == NULL) {
+    fprintf(stderr, "Could not allocate the times of %d trials\n", trials);
+    return 1;
+  }
+
+  printf("strategy,size,workers,kernel,barrier,trials,median_ms,p95_ms,min_ms,gb_per_sec\n");
+  for (i = 0; i < numSizes; i++) {
+    size = sizes[i];
+    if (!matrixAlloc(&matrix, size, size, hugePages)) {
+      fprintf(stderr, "Could not allocate a %d x %d matrix\n", size, size);
+      return 1;
+    }
+    fillMatrix = true;
+    haveExpected = false;
+    for (k = 0; k < numCounts; k++) {
+      numWorkers = workers[k] < MAXWORKERS ? workers[k] : MAXWORKERS;
+      stripSize = size/numWorkers;
+      if (!barrierInit(&barrier, barrierKindUsed, numWorkers)) {
+        fprintf(stderr, "Could not set up the barrier\n");
+        return 1;
+      }
+      /* the main thread is Worker[0] */
+      for (l = 1; l < numWorkers; l++)
+        pthread_create(&workerid[l], &attr, Worker, (void *) l);
+      Worker((void *) 0);
+      for (l = 1; l < numWorkers; l++)
+        pthread_join(workerid[l], NULL);
+      barrierDestroy(&barrier);
+    }
+    matrixFree(&matrix);
+  }
+  free(times);
+  return mismatch ? 1 : 0;
+}
+
+/* start r at the first element of row i */
+void startReduction(reduction *r, int i) {
+  r->sum = 0;
+  r->maxValue = r->minValue = matrixRow(&matrix, i)[0];
+  r->maxi = r->mini = i;
+  r->maxj = r->minj = 0;
+}
+
+/* add rows first..last to r; on equal values r keeps the first occurrence */
+void reduceRows(reduction *r, int first, int last) {
+  rowStats row;
+  int i;
+
+  for (i = first; i <= last; i++) {
+    rowReduce(matrixRow(&matrix, i), size, &row);
+    r->sum += row.sum;
+    if (r->maxValue < row.maxValue) {
+      r->maxValue = row.maxValue;
+      r->maxi = i;
+      r->maxj = row.maxj;
+    }
+    if (r->minValue > row.minValue) {
+      r->minValue = row.minValue;
+      r->mini = i;
+      r->minj = row.minj;
+    }
+  }
+}
+
+/* Add b to a, where every row of b comes after every row of a */
+void mergeReduction(reduction *a, const reduction *b) {
+  a->sum += b->sum;
+  if (a->maxValue < b->maxValue) {
+    a->maxValue = b->maxValue;
+    a->maxi = b->maxi;
+    a->maxj = b->maxj;
+  }
+  if (a->minValue > b->minValue) {
+    a->minValue = b->minValue;
+    a->mini = b->mini;
+    a->minj = b->minj;
+  }
+}
+
+/* publish r to the sink, with linear indexes */
+void publishReduction(const reduction *r) {
+  sinkPublish(&sink, r->sum, r->maxValue, (uint64_t) r->maxi * size + r->maxj,
+              r->minValue, (uint64_t) r->mini * size + r->minj);
+}
+
+/* the totals held by the sink */
+void readSink(reduction *r) {
+  uint64_t maxIndex, minIndex;
+
+  sinkRead(&sink, &r->sum, &r->maxValue, &maxIndex, &r->minValue, &minIndex);
+  r->maxi = (int) (maxIndex / size);
+  r->maxj = (int) (maxIndex % size);
+  r->mini = (int) (minIndex / size);
+  r->minj = (int) (minIndex % size);
+}
+
+/* Guided dispenser, as in matrixSumC.c with a minimum chunk of one row */
+int grabRows(int *first) {
+  int start, chunk;
+
+  start = atomic_load_explicit(&nextRow, memory_order_relaxed);
+  do {
+    if (start >= size) return 0;
+    chunk = (size - start) / (2*numWorkers);
+    if (chunk < 1) chunk = 1;
+  } while (!atomic_compare_exchange_weak_explicit(&nextRow, &start, start + chunk,
+                                                  memory_order_relaxed, memory_order_relaxed));
+  *first = start;
+  return chunk;
+}
+
+/* Worker[0]: get the state of a strategy ready for the next trial */
+void resetTrial(int strategy) {
+  int i;
+
+  switch (strategy) {
+  case TREE:
+    for (i = 0; i < numWorkers; i++)
+      atomic_store(&partials[i].ready, 0);
+    break;
+  case LOCKED:
+  case LOCKFREE:
+  case BAG:
+  case GUIDED:
+    sinkDestroy(&sink);
+    sinkInit(&sink, strategy == LOCKED ? SINK_LOCKED : SINK_LOCKFREE, (uint64_t) size * size);
+    bagOfTasks = 0;
+    atomic_store(&nextRow, 0);
+    break;
+  }
+}
+
+/* One reduction of the whole matrix by the given strategy. Every worker
+   calls it; Worker[0] returns with the totals in *result */
+void runTrial(long myid, int strategy, reduction *result) {
+  reduction mine;
+  int i, s, first, last, rows;
+
+  starts[myid] = read_timer();
+  first = myid*stripSize;
+  last = (myid == numWorkers - 1) ? (size - 1) : (first + stripSize - 1);
+
+  switch (strategy) {
+  case STRIP:
+    startReduction(&parts[myid], first);
+    reduceRows(&parts[myid], first, last);
+    Barrier(myid);
+    if (myid == 0) {
+      *result = parts[0];
+      for (i = 1; i < numWorkers; i++)
+        mergeReduction(result, &parts[i]);
+    }
+    break;
+
+  case TREE:
+    startReduction(&partials[myid].r, first);
+    reduceRows(&partials[myid].r, first, last);
+    for (s = 1; s < numWorkers && myid % (2*s) == 0; s *= 2) {
+      if (myid + s >= numWorkers) continue;
+      while (!atomic_load_explicit(&partials[myid + s].ready, memory_order_acquire))
+        sched_yield();
+      mergeReduction(&partials[myid].r, &partials[myid + s].r);
+    }
+    atomic_store_explicit(&partials[myid].ready, 1, memory_order_release);
+    if (myid == 0) *result = partials[0].r;
+    break;
+
+  case LOCKED:
+  case LOCKFREE:
+    startReduction(&mine, first);
+    reduceRows(&mine, first, last);
+    publishReduction(&mine);
+    Barrier(myid);
+    if (myid == 0) readSink(result);
+    break;
+
+  case BAG:
+  case GUIDED:
+    startReduction(&mine, 0);
+    while (true) {
+      if (strategy == GUIDED)
+        rows = grabRows(&first);
+      else {
+        pthread_mutex_lock(&bagLock);
+        first = bagOfTasks++;
+        pthread_mutex_unlock(&bagLock);
+        rows = (first < size) ? 1 : 0;
+      }
+      if (rows == 0) break;
+      reduceRows(&mine, first, first + rows - 1);
+    }
+    publishReduction(&mine);
+    Barrier(myid);
+    if (myid == 0) readSink(result);
+    break;
+  }
+}
+
+int compareDoubles(const void *a, const void *b) {
+  double x = *(const double *) a, y = *(const double *) b;
+  return (x > y) - (x < y);
+}
+
+/* Worker[0]: check a result against the first strategy on this matrix */
+void checkResult(int strategy, const reduction *r) {
+  if (!haveExpected) {
+    expected = *r;
+    haveExpected = true;
+  } else if (memcmp(r, &expected, sizeof(reduction)) != 0) {
+    fprintf(stderr, "%s with %d workers on %d x %d: total %lld max %d at (%d, %d)"
+            " min %d at (%d, %d), expected total %lld max %d at (%d, %d) min %d at (%d, %d)\n",
+            strategyNames[strategy], numWorkers, size, size,
+            r->sum, r->maxValue, r->maxi, r->maxj, r->minValue, r->mini, r->minj,
+            expected.sum, expected.maxValue, expected.maxi, expected.maxj,
+            expected.minValue, expected.mini, expected.minj);
+    mismatch = true;
+  }
+}
+
+/* Worker[0]: print the line of one strategy; the 95th percentile is
+   taken by nearest rank, the ceil(0.95 trials)-th smallest time */
+void printTimes(int strategy) {
+  double median, bytes = (double) size * size * sizeof(int);
+
+  qsort(times, trials, sizeof(double), compareDoubles);
+  median = times[(trials - 1) / 2];
+  printf("%s,%d,%d,%s,%s,%d,%.4f,%.4f,%.4f,%.3f\n", strategyNames[strategy],
+         size, numWorkers, rowKernelName, barrierNames[barrierKindUsed], trials,
+         1e3 * median, 1e3 * times[(95 * trials + 99) / 100 - 1], 1e3 * times[0],
+         bytes / median / 1e9);
+  fflush(stdout);
+}
+
+/* Each worker fills its strip if the matrix is new, then for every
+   strategy takes part in the warm-up and timed trials. Worker[0]
+   resets the shared state between trials and times each one from the
+   moment the first worker starts it until Worker[0] holds the totals,
+   which also holds when Worker[0] itself is scheduled late */
+void *Worker(void *arg) {
+  long myid = (long) arg;
+  reduction result;
+  int i, k, t, first, last;
+  double start_time;
+
+  if (pinWorkers) pinWorker(myid);
+  if (fillMatrix) {
+    first = myid*stripSize;
+    last = (myid == numWorkers - 1) ? (size - 1) : (first + stripSize - 1);
+    matrixFillRows(&matrix, first, last, seed, 1000);
+  }
+  Barrier(myid);
+  if (myid == 0) fillMatrix = false;
+
+  for (k = 0; k < numStrategies; k++) {
+    for (t = 0; t < warmup + trials; t++) {
+      if (myid == 0) resetTrial(strategies[k]);
+      Barrier(myid);
+      runTrial(myid, strategies[k], &result);
+      if (myid == 0) {
+        start_time = starts[0];
+        for (i = 1; i < numWorkers; i++)
+          if (starts[i] < start_time) start_time = starts[i];
+        if (t >= warmup) times[t - warmup] = read_timer() - start_time;
+        checkResult(strategies[k], &result);
+      }
+    }
+    if (myid == 0) printTimes(strategies[k]);
+  }
+  Barrier(myid);
+  return NULL;
+}
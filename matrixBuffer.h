@@ -0,0 +1,155 @@
+/* runtime allocated matrix of ints
+
+   The rows are padded to a whole number of cache lines (stride ints
+   apart) rather than to a fixed maximum size. Under Linux the memory
+   comes straight from mmap, so no page is backed until it is first
+   written: if every worker fills the rows it will later reduce
+   (matrixFillRows) before anything else writes them, each strip ends up
+   on the NUMA node of the worker that owns it. With hugePages the
+   buffer is taken from 2 MB huge pages when the system has them
+   reserved, and otherwise advised for transparent huge pages.
+
+*/
+#ifndef MATRIXBUFFER_H
+#define MATRIXBUFFER_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include "counterRng.h"
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#define CACHELINE 64                       /* bytes in a cache line */
+#define HUGEPAGE (2UL*1024*1024)           /* bytes in a huge page */
+
+/* how the memory of a matrixBuffer was obtained */
+#define MATRIX_HEAP 0    /* aligned heap block */
+#define MATRIX_MMAP 1    /* anonymous mapping, small pages */
+#define MATRIX_THP 2     /* anonymous mapping advised for huge pages */
+#define MATRIX_HUGETLB 3 /* reserved 2 MB huge pages */
+#define MATRIX_FILE 4    /* read-only mapping of a matrix file */
+
+typedef struct {
+  int rows, cols;
+  size_t stride; /* ints from the start of one row to the next */
+  int *data;
+  void *mapping; /* start of the allocation, data may lie further in */
+  size_t bytes;  /* size of the allocation */
+  int kind;      /* one of the MATRIX_ constants */
+} matrixBuffer;
+
+/* first element of row i */
+static inline int *matrixRow(const matrixBuffer *m, int i) {
+  return m->data + (size_t) i * m->stride;
+}
+
+/* Allocate a rows x cols matrix without touching its pages.
+   Returns false if the memory could not be obtained */
+static inline bool matrixAlloc(matrixBuffer *m, int rows, int cols, bool hugePages) {
+  size_t perLine = CACHELINE / sizeof(int);
+  void *p;
+
+  m->rows = rows;
+  m->cols = cols;
+  m->stride = (cols + perLine - 1) / perLine * perLine;
+  m->bytes = (size_t) rows * m->stride * sizeof(int);
+  m->data = m->mapping = NULL;
+#ifdef __linux__
+  if (hugePages) {
+    m->bytes = (m->bytes + HUGEPAGE - 1) / HUGEPAGE * HUGEPAGE;
+#ifdef MAP_HUGETLB
+    p = mmap(NULL, m->bytes, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p != MAP_FAILED) {
+      m->data = m->mapping = p;
+      m->kind = MATRIX_HUGETLB;
+      return true;
+    }
+#endif
+  }
+  p = mmap(NULL, m->bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED) return false;
+  m->data = m->mapping = p;
+  m->kind = MATRIX_MMAP;
+#ifdef MADV_HUGEPAGE
+  if (hugePages && madvise(p, m->bytes, MADV_HUGEPAGE) == 0)
+    m->kind = MATRIX_THP;
+#endif
+  return true;
+#else
+  (void) hugePages;
+#ifdef _WIN32
+  p = _aligned_malloc(m->bytes, CACHELINE);
+#else
+  if (posix_memalign(&p, CACHELINE, m->bytes) != 0) p = NULL;
+#endif
+  if (p == NULL) return false;
+  m->data = m->mapping = p;
+  m->kind = MATRIX_HEAP;
+  return true;
+#endif
+}
+
+static inline void matrixFree(matrixBuffer *m) {
+  if (m->data == NULL) return;
+#ifdef __linux__
+  if (m->kind != MATRIX_HEAP) munmap(m->mapping, m->bytes);
+  else
+#endif
+#ifdef _WIN32
+    _aligned_free(m->mapping);
+#else
+    free(m->mapping);
+#endif
+  m->data = m->mapping = NULL;
+}
+
+/* Fill rows first..last with counterRng values in 0..modulus-1 and zero
+   the padding at the end of each row. The pages of these rows are placed
+   by the calling thread */
+static inline void matrixFillRows(matrixBuffer *m, int first, int last,
+                           uint64_t seed, int modulus) {
+  int i, j, *row;
+
+  for (i = first; i <= last; i++) {
+    row = matrixRow(m, i);
+    for (j = 0; j < m->cols; j++)
+      row[j] = (int) (((counterRng(seed, i, j) >> 32) * (uint64_t) modulus) >> 32);
+    for (; j < (int) m->stride; j++)
+      row[j] = 0;
+  }
+}
+
+/* short name of the allocation, for reports */
+static inline const char *matrixKindName(const matrixBuffer *m) {
+  switch (m->kind) {
+    case MATRIX_MMAP: return "small pages";
+    case MATRIX_THP: return "transparent huge pages";
+    case MATRIX_HUGETLB: return "2 MB huge pages";
+    case MATRIX_FILE: return "a file mapping";
+    default: return "heap";
+  }
+}
+
+/* Keep worker myid on one CPU so its strip stays local. Does nothing
+   where thread affinity is not available */
+static inline void pinWorker(long myid) {
+#ifdef __linux__
+  cpu_set_t set;
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+  if (cpus < 1) return;
+  CPU_ZERO(&set);
+  CPU_SET(myid % cpus, &set);
+  pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+  (void) myid;
+#endif
+}
+
+#endif /* MATRIXBUFFER_H */
@@ -0,0 +1,184 @@
+/* binary matrix files
+
+   A matrix file is a matrixFileHeader followed, at dataOffset bytes from
+   the start of the file, by rows rows of cols elements each, rowStride
+   bytes apart. All fields are in the byte order of the machine that
+   wrote the file. Only 32-bit int elements are supported.
+
+   matrixFileMap maps such a file read-only into a matrixBuffer, so the
+   reducers can run over it without copying. A worker that walks its
+   strip from top to bottom calls matrixFileStream before every row: it
+   asks the kernel to read ahead the next window of rows and to drop
+   the window it has finished, so a file larger than memory is read in
+   one sequential pass per strip.
+
+*/
+#ifndef MATRIXFILE_H
+#define MATRIXFILE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <limits.h>
+#include "matrixBuffer.h"
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#define MATRIXFILE_MAGIC "MTRXBIN"
+#define MATRIXFILE_VERSION 1
+#define MATRIXFILE_INT32 1            /* element type: 32-bit int */
+#define MATRIXFILE_DATA 4096          /* dataOffset used by matrixFileWrite */
+#define MATRIXFILE_WINDOW (64UL*1024*1024) /* bytes read ahead per worker */
+
+typedef struct {
+  char magic[8];       /* MATRIXFILE_MAGIC */
+  uint32_t version;    /* MATRIXFILE_VERSION */
+  uint32_t elemType;   /* MATRIXFILE_INT32 */
+  uint64_t rows, cols;
+  uint64_t rowStride;  /* bytes from the start of one row to the next */
+  uint64_t dataOffset; /* bytes from the start of the file to row 0 */
+} matrixFileHeader;
+
+/* Write a rows x cols matrix of counterRng values in 0..modulus-1 to
+   path. Returns false and prints the reason on failure */
+static inline bool matrixFileWrite(const char *path, int rows, int cols,
+                            uint64_t seed, int modulus) {
+  matrixFileHeader h;
+  FILE *f;
+  int i, j, *row;
+  size_t perLine = CACHELINE / sizeof(int);
+  bool ok = true;
+
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, MATRIXFILE_MAGIC, sizeof(MATRIXFILE_MAGIC));
+  h.version = MATRIXFILE_VERSION;
+  h.elemType = MATRIXFILE_INT32;
+  h.rows = rows;
+  h.cols = cols;
+  h.rowStride = (cols + perLine - 1) / perLine * perLine * sizeof(int);
+  h.dataOffset = MATRIXFILE_DATA;
+
+  f = fopen(path, "wb");
+  if (f == NULL) {
+    perror(path);
+    return false;
+  }
+  row = calloc(h.rowStride, 1);
+  if (row == NULL || fwrite(&h, sizeof(h), 1, f) != 1
+      || fseek(f, (long) h.dataOffset, SEEK_SET) != 0)
+    ok = false;
+  for (i = 0; ok && i < rows; i++) {
+    for (j = 0; j < cols; j++)
+      row[j] = (int) (((counterRng(seed, i, j) >> 32) * (uint64_t) modulus) >> 32);
+    if (fwrite(row, h.rowStride, 1, f) != 1) ok = false;
+  }
+  if (fclose(f) != 0) ok = false;
+  if (!ok) fprintf(stderr, "%s: could not write the matrix\n", path);
+  free(row);
+  return ok;
+}
+
+/* Map the matrix file at path into m. Returns false and prints the
+   reason if the file cannot be used */
+static inline bool matrixFileMap(const char *path, matrixBuffer *m) {
+#ifndef _WIN32
+  matrixFileHeader h;
+  struct stat st;
+  void *p;
+  int fd;
+
+  fd = open(path, O_RDONLY);
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    perror(path);
+    if (fd >= 0) close(fd);
+    return false;
+  }
+  if (read(fd, &h, sizeof(h)) != (ssize_t) sizeof(h)
+      || memcmp(h.magic, MATRIXFILE_MAGIC, sizeof(MATRIXFILE_MAGIC)) != 0
+      || h.version != MATRIXFILE_VERSION) {
+    fprintf(stderr, "%s: not a matrix file\n", path);
+    close(fd);
+    return false;
+  }
+  /* every term is bounded by the file size before the next one is
+     used, so that no crafted header can wrap the arithmetic */
+  if (h.elemType != MATRIXFILE_INT32 || h.rows < 1 || h.cols < 1
+      || h.rows > INT_MAX || h.cols > INT_MAX
+      || h.rowStride < h.cols * sizeof(int) || h.rowStride % sizeof(int) != 0
+      || h.dataOffset % sizeof(int) != 0 || h.dataOffset > (uint64_t) st.st_size
+      || h.cols * sizeof(int) > (uint64_t) st.st_size - h.dataOffset
+      || (h.rows > 1 && h.rowStride > ((uint64_t) st.st_size - h.dataOffset - h.cols * sizeof(int))
+                                      / (h.rows - 1))) {
+    fprintf(stderr, "%s: unsupported element type or bad dimensions\n", path);
+    close(fd);
+    return false;
+  }
+  p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) {
+    perror(path);
+    return false;
+  }
+  madvise(p, st.st_size, MADV_SEQUENTIAL);
+  m->rows = (int) h.rows;
+  m->cols = (int) h.cols;
+  m->stride = h.rowStride / sizeof(int);
+  m->mapping = p;
+  m->data = (int *) ((char *) p + h.dataOffset);
+  m->bytes = st.st_size;
+  m->kind = MATRIX_FILE;
+  return true;
+#else
+  (void) m;
+  fprintf(stderr, "%s: matrix files are not supported on this system\n", path);
+  return false;
+#endif
+}
+
+/* advise the kernel about rows first..last, rounded out to whole pages */
+static inline void matrixFileAdvise(const matrixBuffer *m, int first, int last, int advice) {
+#ifndef _WIN32
+  uintptr_t page = (uintptr_t) sysconf(_SC_PAGESIZE);
+  uintptr_t from, to;
+
+  if (first < 0) first = 0;
+  if (last >= m->rows) last = m->rows - 1;
+  if (first > last) return;
+  from = (uintptr_t) matrixRow(m, first) & ~(page - 1);
+  to = (uintptr_t) (matrixRow(m, last) + m->cols);
+  if (advice == MADV_DONTNEED) {
+    /* only drop pages that hold nothing past row last */
+    to &= ~(page - 1);
+    if (to <= from) return;
+  }
+  madvise((void *) from, to - from, advice);
+#else
+  (void) m; (void) first; (void) last; (void) advice;
+#endif
+}
+
+/* Streaming hints for a worker about to reduce row i of its strip
+   first..last: at every window boundary, read the next window ahead and
+   drop the one before the current window */
+static inline void matrixFileStream(const matrixBuffer *m, int first, int last, int i) {
+#ifndef _WIN32
+  int window = (int) (MATRIXFILE_WINDOW / (m->stride * sizeof(int)));
+
+  if (m->kind != MATRIX_FILE) return;
+  if (window < 1) window = 1;
+  if ((i - first) % window != 0) return;
+  if (i == first)
+    matrixFileAdvise(m, i, (last < i + window - 1) ? last : i + window - 1, MADV_WILLNEED);
+  if (i + window <= last)
+    matrixFileAdvise(m, i + window, (last < i + 2*window - 1) ? last : i + 2*window - 1, MADV_WILLNEED);
+  if (i - window >= first)
+    matrixFileAdvise(m, i - window, i - 1, MADV_DONTNEED);
+#else
+  (void) m; (void) first; (void) last; (void) i;
+#endif
+}
+
+#endif /* MATRIXFILE_H */
@@ -0,0 +1,37 @@
+/* write a random matrix file
+
+   features: writes a rows x cols matrix of counterRng values in the
+             binary format of matrixFile.h, for the file mode of the
+             reducers; the values are the same ones the reducers
+             generate themselves for the same seed and modulus
+
+   usage under Linux:
+     gcc matrixGen.c -o matrixGen
+     matrixGen path rows [cols] [seed] [modulus]
+
+*/
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include "matrixFile.h"
+
+int main(int argc, char *argv[]) {
+  int rows, cols, modulus;
+  uint64_t seed;
+
+  if (argc < 3) {
+    fprintf(stderr, "usage: %s path rows [cols] [seed] [modulus]\n", argv[0]);
+    return 1;
+  }
+  rows = atoi(argv[2]);
+  cols = (argc > 3)? atoi(argv[3]) : rows;
+  seed = (argc > 4)? strtoull(argv[4], NULL, 10) : 1;
+  modulus = (argc > 5)? atoi(argv[5]) : 1000;
+  if (rows < 1 || cols < 1 || modulus < 1) {
+    fprintf(stderr, "rows, cols and modulus must be positive\n");
+    return 1;
+  }
+  return matrixFileWrite(argv[1], rows, cols, seed, modulus) ? 0 : 1;
+}
@@ -6,36 +6,41 @@
 
    usage under Linux:
      gcc matrixSum.c -lpthread
-     a.out size numWorkers
+     a.out size numWorkers [huge] [pin] [seed=N] [barrier=KIND]
+
+     KIND is mutex (default), sense, tree or dissemination; see barrier.h
+
+     compiled with -DINSTRUMENT, also prints per-worker counters (rows,
+     busy, waiting and idle time, cycles, LLC misses) and the imbalance
+     between the workers; see workerStats.h
 
 */
 #ifndef _REENTRANT
 #define _REENTRANT
 #endif
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
 #include <pthread.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <string.h>
 #include <time.h>
 #include <sys/time.h>
-#define MAXSIZE 10000  /* maximum matrix size */
+#include "matrixBuffer.h"
+#include "barrier.h"
+#include "workerStats.h"
+#define DEFAULTSIZE 10000  /* matrix size when none is given */
 #define MAXWORKERS 10   /* maximum number of workers */
 
-pthread_mutex_t barrier;  /* mutex lock for the barrier */
-pthread_cond_t go;        /* condition variable for leaving */
+barrierState barrier;     /* the barrier, of the kind chosen at startup */
+int barrierKindUsed = BARRIER_MUTEX; /* see barrier.h */
 int numWorkers;           /* number of workers */
-int numArrived = 0;       /* number who have arrived */
-
-/* a reusable counter barrier */
-void Barrier() {
-  pthread_mutex_lock(&barrier);
-  numArrived++;
-  if (numArrived == numWorkers) {
-    numArrived = 0;
-    pthread_cond_broadcast(&go);
-  } else
-    pthread_cond_wait(&go, &barrier);
-  pthread_mutex_unlock(&barrier);
+
+/* a reusable barrier; myid is the caller's worker number */
+void Barrier(long myid) {
+  barrierWait(&barrier, myid);
 }
 
 /* timer */
@@ -52,16 +57,20 @@ double read_timer() {
     return (end.tv_sec - start.tv_sec) + 1.0e-6 * (end.tv_usec - start.tv_usec);
 }
 
-double start_time, end_time; /* start and end times */
+double init_time, start_time, end_time; /* start and end times */
 int size, stripSize;  /* assume size is multiple of numWorkers */
-int sums[MAXWORKERS]; /* partial sums */
-int matrix[MAXSIZE][MAXSIZE]; /* matrix */
+long long sums[MAXWORKERS]; /* partial sums */
+matrixBuffer matrix; /* matrix */
+bool pinWorkers = false; /* pin each worker to one CPU */
+uint64_t seed = 1; /* selects the random matrix */
 
 void *Worker(void *);
+void printMatrix();
 
 /* read command line, initialize, and create threads */
 int main(int argc, char *argv[]) {
-  int i, j;
+  int i;
+  bool hugePages = false;
   long l; /* use long in case of a 64-bit system */
   pthread_attr_t attr;
   pthread_t workerid[MAXWORKERS];
@@ -70,47 +79,70 @@ int main(int argc, char *argv[]) {
   pthread_attr_init(&attr);
   pthread_attr_setscope(&attr, PTHREAD_SCOPE_SYSTEM);
 
-  /* initialize mutex and condition variable */
-  pthread_mutex_init(&barrier, NULL);
-  pthread_cond_init(&go, NULL);
-
   /* read command line args if any */
-  size = (argc > 1)? atoi(argv[1]) : MAXSIZE;
+  size = (argc > 1)? atoi(argv[1]) : DEFAULTSIZE;
   numWorkers = (argc > 2)? atoi(argv[2]) : MAXWORKERS;
-  if (size > MAXSIZE) size = MAXSIZE;
+  if (size < 1) size = 1;
+  if (numWorkers < 1) numWorkers = 1;
   if (numWorkers > MAXWORKERS) numWorkers = MAXWORKERS;
   stripSize = size/numWorkers;
+  for (i = 3; i < argc; i++) {
+    if (strcmp(argv[i], "huge") == 0)
+      hugePages = true;
+    else if (strcmp(argv[i], "pin") == 0)
+      pinWorkers = true;
+    else if (strncmp(argv[i], "barrier=", 8) == 0) {
+      barrierKindUsed = barrierKind(argv[i] + 8);
+      if (barrierKindUsed < 0) {
+        fprintf(stderr, "unknown barrier %s\n", argv[i] + 8);
+        return 1;
+      }
+    }
+    else if (strncmp(argv[i], "seed=", 5) == 0)
+      seed = strtoull(argv[i] + 5, NULL, 10);
+  }
 
-  /* initialize the matrix */
-  for (i = 0; i < size; i++) {
-	  for (j = 0; j < size; j++) {
-          matrix[i][j] = rand()%1000;
-	  }
+  if (!barrierInit(&barrier, barrierKindUsed, numWorkers)) {
+    fprintf(stderr, "Could not set up the barrier\n");
+    return 1;
   }
 
-  /* print the matrix */
+  /* allocate the matrix; its pages are placed by the workers */
+  if (!matrixAlloc(&matrix, size, size, hugePages)) {
+    fprintf(stderr, "Could not allocate a %d x %d matrix\n", size, size);
+    return 1;
+  }
+  if (hugePages)
+    printf("The matrix uses %s\n", matrixKindName(&matrix));
+
+  /* do the parallel work: create the workers */
+  init_time = read_timer();
+  for (l = 0; l < numWorkers; l++)
+    pthread_create(&workerid[l], &attr, Worker, (void *) l);
+  pthread_exit(NULL);
+}
+
+/* print the matrix */
+void printMatrix() {
 #ifdef DEBUG
+  int i, j;
+
   for (i = 0; i < size; i++) {
 	  printf("[ ");
 	  for (j = 0; j < size; j++) {
-	    printf(" %d", matrix[i][j]);
+	    printf(" %d", matrixRow(&matrix, i)[j]);
 	  }
 	  printf(" ]\n");
   }
 #endif
-
-  /* do the parallel work: create the workers */
-  start_time = read_timer();
-  for (l = 0; l < numWorkers; l++)
-    pthread_create(&workerid[l], &attr, Worker, (void *) l);
-  pthread_exit(NULL);
 }
 
 /* Each worker sums the values in one strip of the matrix.
    After a barrier, worker(0) computes and prints the total */
 void *Worker(void *arg) {
   long myid = (long) arg;
-  int total, i, j, first, last;
+  long long total;
+  int i, j, first, last;
 
 #ifdef DEBUG
   printf("worker %d (pthread id %d) has started\n", myid, pthread_self());
@@ -120,13 +152,28 @@ void *Worker(void *arg) {
   first = myid*stripSize;
   last = (myid == numWorkers - 1) ? (size - 1) : (first + stripSize - 1);
 
+  /* fill my strip, which also places it on my node */
+  if (pinWorkers) pinWorker(myid);
+  matrixFillRows(&matrix, first, last, seed, 1000);
+  Barrier(myid);
+  if (myid == 0) {
+    printMatrix();
+    start_time = read_timer();
+  }
+  Barrier(myid);
+  STATS_BEGIN(myid);
+
   /* sum values in my strip */
   total = 0;
-  for (i = first; i <= last; i++)
+  for (i = first; i <= last; i++) {
     for (j = 0; j < size; j++)
-      total += matrix[i][j];
+      total += matrixRow(&matrix, i)[j];
+    STATS_ROWS(myid, 1, size * sizeof(int));
+  }
   sums[myid] = total;
-  Barrier();
+  STATS_WAIT(myid, Barrier(myid));
+  STATS_END(myid);
+  STATS_ONLY(Barrier(myid)); /* every worker's counters are final before the report */
   if (myid == 0) {
     total = 0;
     for (i = 0; i < numWorkers; i++)
@@ -134,7 +181,10 @@ void *Worker(void *arg) {
     /* get end time */
     end_time = read_timer();
     /* print results */
-    printf("The total is %d\n", total);
+    printf("The total is %lld\n", total);
+    printf("The initialization time is %g sec\n", start_time - init_time);
     printf("The execution time is %g sec\n", end_time - start_time);
+    STATS_REPORT(numWorkers, end_time - start_time);
+    matrixFree(&matrix); /* everyone else is past the barrier */
   }
 }
@@ -1,24 +1,64 @@
 /* matrix summation using pthreads
 
-   features: uses a barrier; the Worker[0] computes
-             the total sum from partial sums computed by Workers
-             and prints the total sum to the standard output
+   features: uses a barrier; the Workers combine their partial
+             results in pairs, in a tree of log2(numWorkers) levels,
+             and Worker[0] prints the totals to the standard output
 
    usage under Linux:
-     gcc matrixSum.c -lpthread
-     a.out size numWorkers
+     gcc matrixSumA.c -lpthread
+     a.out size numWorkers [kernel=avx512|avx2|scalar] [huge] [pin] [seed=N] [topk=K]
+       [aggregates[=path]] [quantiles=Q,...]
+     a.out 0 numWorkers file=path [kernel=...] [pin]
+
+     file=path reduces the matrix file written by matrixGen (see
+     matrixFile.h) through a read-only mapping instead of generating
+     a matrix; its size comes from the file
+
+     topk=K also prints the K largest and K smallest elements with their
+     positions, found in the same pass (see topK.h); equal values are
+     listed in row-major order
+
+     aggregates also computes the sum, min and max of every row and of
+     every column in the same pass, in cache-sized tiles with column
+     accumulators private to each worker (see aggregates.h); prints the
+     extreme row and column sums, and with =path writes every row and
+     column to path as CSV
+
+     quantiles=Q,... also prints the elements of the quantiles Q (from 0
+     to 1, so 0.5,0.99 are the median and p99), without sorting: each
+     worker samples its strip, worker 0 brackets every quantile from the
+     sample, then the workers count the elements below each bracket and
+     copy out the few inside it in one more pass, and worker 0 selects
+     the element among the copies (see quantiles.h)
+
+     compiled with -DINSTRUMENT, also prints per-worker counters (rows,
+     busy, waiting and idle time, cycles, LLC misses) and the imbalance
+     between the workers; see workerStats.h
 
 */
 #ifndef _REENTRANT
 #define _REENTRANT
 #endif
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
 #include <pthread.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdatomic.h>
+#include <sched.h>
+#include <string.h>
 #include <time.h>
 #include <sys/time.h>
-#define MAXSIZE 10000  /* maximum matrix size */
+#include "rowKernel.h"
+#include "matrixBuffer.h"
+#include "matrixFile.h"
+#include "workerStats.h"
+#include "topK.h"
+#include "aggregates.h"
+#include "quantiles.h"
+#define DEFAULTSIZE 10000  /* matrix size when none is given */
 #define MAXWORKERS 10   /* maximum number of workers */
 
 pthread_mutex_t barrier;  /* mutex lock for the barrier */
@@ -52,17 +92,45 @@ double read_timer() {
     return (end.tv_sec - start.tv_sec) + 1.0e-6 * (end.tv_usec - start.tv_usec);
 }
 
-double start_time, end_time; /* start and end times */
+double init_time, start_time, end_time; /* start and end times */
 int size, stripSize;  /* assume size is multiple of numWorkers */
-int sums[MAXWORKERS], maxValues[MAXWORKERS], maxIndexesi[MAXWORKERS], maxIndexesj[MAXWORKERS];
-int minValues[MAXWORKERS], minIndexesi[MAXWORKERS], minIndexesj[MAXWORKERS];
-int matrix[MAXSIZE][MAXSIZE]; /* matrix */
+int cols;             /* elements per row, size unless read from a file */
+
+/* the partial results of one worker, on cache lines of their own so
+   that neighbouring workers do not write to the same line */
+typedef struct {
+  _Alignas(CACHELINE) long long sum;
+  int maxValue, maxi, maxj;
+  int minValue, mini, minj;
+  topKHeap largest, smallest; /* topk: the K largest and smallest */
+  atomic_int ready; /* set once this holds the results of its subtree */
+} partialResult;
+
+partialResult partials[MAXWORKERS];
+matrixBuffer matrix; /* matrix */
+bool pinWorkers = false; /* pin each worker to one CPU */
+uint64_t seed = 1; /* selects the random matrix */
+int topK = 0; /* how many largest and smallest elements to list */
+bool aggregates = false; /* compute the row and column aggregates */
+const char *aggregatesPath = NULL; /* where to write them, if anywhere */
+rowStats *rowAggs;       /* aggregates of every row */
+columnStats colAggs;     /* aggregates of every column */
+columnStats colPrivate[MAXWORKERS]; /* each worker's column accumulators */
+int numQuantiles = 0;    /* how many quantiles to find */
+double quantiles[QUANTILE_MAX]; /* which */
+quantileSelector selection; /* state of their selection */
 
 void *Worker(void *);
+void printMatrix();
+void mergePartial(partialResult *, const partialResult *);
+void printTopK(const char *, topKHeap *);
+void printAggregates();
 
 /* read command line, initialize, and create threads */
 int main(int argc, char *argv[]) {
-  int i, j;
+  int i;
+  bool hugePages = false, ok;
+  const char *kernelName = NULL, *path = NULL;
   long l; /* use long in case of a 64-bit system */
   pthread_attr_t attr;
   pthread_t workerid[MAXWORKERS];
@@ -76,42 +144,182 @@ int main(int argc, char *argv[]) {
   pthread_cond_init(&go, NULL);
 
   /* read command line args if any */
-  size = (argc > 1)? atoi(argv[1]) : MAXSIZE;
+  size = (argc > 1)? atoi(argv[1]) : DEFAULTSIZE;
   numWorkers = (argc > 2)? atoi(argv[2]) : MAXWORKERS;
-  if (size > MAXSIZE) size = MAXSIZE;
+  if (size < 1) size = 1;
+  if (numWorkers < 1) numWorkers = 1;
   if (numWorkers > MAXWORKERS) numWorkers = MAXWORKERS;
-  stripSize = size/numWorkers;
+  for (i = 3; i < argc; i++) {
+    if (strncmp(argv[i], "kernel=", 7) == 0)
+      kernelName = argv[i] + 7;
+    else if (strcmp(argv[i], "huge") == 0)
+      hugePages = true;
+    else if (strcmp(argv[i], "pin") == 0)
+      pinWorkers = true;
+    else if (strncmp(argv[i], "seed=", 5) == 0)
+      seed = strtoull(argv[i] + 5, NULL, 10);
+    else if (strncmp(argv[i], "topk=", 5) == 0)
+      topK = atoi(argv[i] + 5);
+    else if (strcmp(argv[i], "aggregates") == 0)
+      aggregates = true;
+    else if (strncmp(argv[i], "aggregates=", 11) == 0) {
+      aggregates = true;
+      aggregatesPath = argv[i] + 11;
+    }
+    else if (strncmp(argv[i], "file=", 5) == 0)
+      path = argv[i] + 5;
+    else if (strncmp(argv[i], "quantiles=", 10) == 0) {
+      numQuantiles = quantileParse(argv[i] + 10, quantiles);
+      if (numQuantiles == 0) {
+        fprintf(stderr, "bad quantiles %s: up to %d of them, each from 0 to 1\n", argv[i] + 10, QUANTILE_MAX);
+        return 1;
+      }
+    }
+  }
+  rowKernelInit(kernelName);
 
-  /* initialize the matrix */
-  for (i = 0; i < size; i++) {
-	  for (j = 0; j < size; j++) {
-          matrix[i][j] = rand()%100;
-	  }
+  if (path != NULL) {
+    /* map the file; the workers stream through it */
+    init_time = read_timer();
+    if (!matrixFileMap(path, &matrix)) return 1;
+    size = matrix.rows;
+    cols = matrix.cols;
+    printf("The matrix is %d x %d from %s\n", size, cols, path);
+  } else {
+    /* allocate the matrix; its pages are placed by the workers */
+    cols = size;
+    if (!matrixAlloc(&matrix, size, cols, hugePages)) {
+      fprintf(stderr, "Could not allocate a %d x %d matrix\n", size, cols);
+      return 1;
+    }
+    if (hugePages)
+      printf("The matrix uses %s\n", matrixKindName(&matrix));
+    init_time = read_timer();
+  }
+  stripSize = size/numWorkers;
+  if (topK > 0) {
+    if ((long long) topK > (long long) size * cols) topK = size * cols;
+    for (i = 0; i < numWorkers; i++)
+      if (!topKInit(&partials[i].largest, topK, true)
+          || !topKInit(&partials[i].smallest, topK, false)) {
+        fprintf(stderr, "Could not allocate the top %d lists\n", topK);
+        return 1;
+      }
+  }
+  if (aggregates) {
+    rowAggs = malloc(size * sizeof(rowStats));
+    ok = rowAggs != NULL && columnStatsAlloc(&colAggs, cols);
+    for (i = 0; i < numWorkers; i++)
+      ok = ok && columnStatsAlloc(&colPrivate[i], cols);
+    if (!ok) {
+      fprintf(stderr, "Could not allocate the aggregates\n");
+      return 1;
+    }
+  }
+  if (numQuantiles > 0
+      && !quantileInit(&selection, quantiles, numQuantiles, (long long) size * cols, numWorkers, seed, NULL)) {
+    fprintf(stderr, "Could not allocate the selection\n");
+    return 1;
   }
 
-  /* print the matrix */
+  /* do the parallel work: create the workers */
+  for (l = 0; l < numWorkers; l++)
+    pthread_create(&workerid[l], &attr, Worker, (void *) l);
+  pthread_exit(NULL);
+}
+
+/* print the matrix */
+void printMatrix() {
 #ifdef DEBUG
+  int i, j;
+
   for (i = 0; i < size; i++) {
 	  printf("[ ");
-	  for (j = 0; j < size; j++) {
-	    printf(" %d", matrix[i][j]);
+	  for (j = 0; j < cols; j++) {
+	    printf(" %d", matrixRow(&matrix, i)[j]);
 	  }
 	  printf(" ]\n");
   }
 #endif
+}
 
-  /* do the parallel work: create the workers */
-  start_time = read_timer();
-  for (l = 0; l < numWorkers; l++)
-    pthread_create(&workerid[l], &attr, Worker, (void *) l);
-  pthread_exit(NULL);
+/* print the entries of h, best first */
+void printTopK(const char *what, topKHeap *h) {
+  int i;
+
+  topKSort(h);
+  printf("The %d %s values:\n", h->n, what);
+  for (i = 0; i < h->n; i++)
+    printf("  %d at row %d, column %d\n", h->e[i].value, h->e[i].row, h->e[i].col);
 }
 
-/* Each worker sums the values in one strip of the matrix.
-   After a barrier, worker(0) computes and prints the total */
+/* print the smallest and largest row and column sums, and write every
+   row and column to aggregatesPath if there is one */
+void printAggregates() {
+  int i, lo, hi;
+  FILE *f;
+
+  lo = hi = 0;
+  for (i = 1; i < size; i++) {
+    if (rowAggs[i].sum < rowAggs[lo].sum) lo = i;
+    if (rowAggs[i].sum > rowAggs[hi].sum) hi = i;
+  }
+  printf("The row sums range from %lld (row %d) to %lld (row %d)\n",
+         rowAggs[lo].sum, lo, rowAggs[hi].sum, hi);
+  lo = hi = 0;
+  for (i = 1; i < cols; i++) {
+    if (colAggs.sum[i] < colAggs.sum[lo]) lo = i;
+    if (colAggs.sum[i] > colAggs.sum[hi]) hi = i;
+  }
+  printf("The column sums range from %lld (column %d) to %lld (column %d)\n",
+         colAggs.sum[lo], lo, colAggs.sum[hi], hi);
+  if (aggregatesPath == NULL) return;
+
+  if ((f = fopen(aggregatesPath, "w")) == NULL) {
+    perror(aggregatesPath);
+    return;
+  }
+  fprintf(f, "kind,index,sum,min,min_at,max,max_at\n");
+  for (i = 0; i < size; i++)
+    fprintf(f, "row,%d,%lld,%d,%d,%d,%d\n", i, rowAggs[i].sum,
+            rowAggs[i].minValue, rowAggs[i].minj, rowAggs[i].maxValue, rowAggs[i].maxj);
+  for (i = 0; i < cols; i++)
+    fprintf(f, "column,%d,%lld,%d,%d,%d,%d\n", i, colAggs.sum[i],
+            colAggs.minValue[i], colAggs.mini[i], colAggs.maxValue[i], colAggs.maxi[i]);
+  fclose(f);
+}
+
+/* Add the results of the workers in b to a. Every row of b comes after
+   every row of a, so on equal values a keeps the first occurrence */
+void mergePartial(partialResult *a, const partialResult *b) {
+  a->sum += b->sum;
+  if (topK > 0) {
+    topKMerge(&a->largest, &b->largest);
+    topKMerge(&a->smallest, &b->smallest);
+  }
+  if (a->maxValue < b->maxValue) {
+    a->maxValue = b->maxValue;
+    a->maxi = b->maxi;
+    a->maxj = b->maxj;
+  }
+  if (a->minValue > b->minValue) {
+    a->minValue = b->minValue;
+    a->mini = b->mini;
+    a->minj = b->minj;
+  }
+}
+
+/* Each worker sums the values in one strip of the matrix. The
+   partial results are then merged in pairs: at step s, every worker
+   whose id is a multiple of 2s waits for worker id+s and merges its
+   subtree, so worker(0) ends with the totals after log2(numWorkers)
+   steps and prints them */
 void *Worker(void *arg) {
   long myid = (long) arg;
-  int total, i, j, first, last, maxValue, maxi, maxj, minValue, mini, minj;
+  long long total;
+  rowStats row;
+  partialResult *me;
+  int i, j, w, s, first, last, maxValue, maxi, maxj, minValue, mini, minj;
 
 #ifdef DEBUG
   printf("worker %d (pthread id %d) has started\n", myid, pthread_self());
@@ -122,65 +330,139 @@ void *Worker(void *arg) {
   last = (myid == numWorkers - 1) ? (size - 1) : (first + stripSize - 1);
   //if last worker, you work up to the last strip
 
+  /* fill my strip, which also places it on my node */
+  if (pinWorkers) pinWorker(myid);
+  if (matrix.kind != MATRIX_FILE)
+    matrixFillRows(&matrix, first, last, seed, 100);
+  Barrier();
+  if (myid == 0) {
+    printMatrix();
+    start_time = read_timer();
+  }
+  Barrier();
+  STATS_BEGIN(myid);
+
   /* sum values in my strip */
   total = 0;
-  maxValue = matrix[first][0];
+  maxValue = matrixRow(&matrix, first)[0];
   maxi = first;
   maxj = 0;
-  minValue = matrix[first][0];
+  minValue = matrixRow(&matrix, first)[0];
   mini = first;
   minj = 0;
-  for (i = first; i <= last; i++)
-    for (j = 0; j < size; j++){
-      total += matrix[i][j];
-      if (maxValue < matrix[i][j]){ //If it is biggger than the current value, add it
-        maxValue = matrix[i][j];
-        maxi = i;
-        maxj = j;
-      }
-      if (minValue > matrix[i][j]){ //If it is smaller, take the element
-        minValue = matrix[i][j];
-        mini = i;
-        minj = j;
-      }
+  for (i = first; i <= last; i++) {
+    matrixFileStream(&matrix, first, last, i);
+    if (aggregates) {
+      /* a tile of rows at a time, see aggregates.h */
+      if ((i - first) % AGG_TILEROWS == 0)
+        aggregateRows(&matrix, cols, i, (i + AGG_TILEROWS - 1 < last) ? i + AGG_TILEROWS - 1 : last,
+                      i == first, rowAggs, &colPrivate[myid]);
+      row = rowAggs[i];
+    } else
+      rowReduce(matrixRow(&matrix, i), cols, &row);
+    STATS_ROWS(myid, 1, cols * sizeof(int));
+    if (topK > 0) {
+      topKRow(&partials[myid].largest, matrixRow(&matrix, i), cols, i, row.maxValue);
+      topKRow(&partials[myid].smallest, matrixRow(&matrix, i), cols, i, row.minValue);
+    }
+    total += row.sum;
+    if (maxValue < row.maxValue){ //If it is biggger than the current value, add it
+      maxValue = row.maxValue;
+      maxi = i;
+      maxj = row.maxj;
+    }
+    if (minValue > row.minValue){ //If it is smaller, take the element
+      minValue = row.minValue;
+      mini = i;
+      minj = row.minj;
+    }
   }
-  //We now add the max and min values to a global list for this thread.
-  //We also add the sum for this thread.
-  maxValues[myid] = maxValue;
-  maxIndexesi[myid] = maxi;
-  maxIndexesj[myid] = maxj;
-  minValues[myid] = minValue;
-  minIndexesi[myid] = mini;
-  minIndexesj[myid] = minj;
-  sums[myid] = total;
-  Barrier(); //When all threads are finished
-  if (myid == 0) { //Thread 0 does this work, not parallel
-    total = 0;
-    maxValue = maxValues[0];
-    minValue = minValues[0];
-
-    //Go through the threads and add the biggest and smallest values
-    for (i = 0; i < numWorkers; i++) {
-      total += sums[i];
-      if (maxValue < maxValues[i]){
-        maxValue = maxValues[i];
-        maxi = maxIndexesi[i];
-        maxj = maxIndexesj[i];
-      }
-      if (minValue > minValues[i]){
-        minValue = minValues[i];
-        mini = minIndexesi[i];
-        minj = minIndexesj[i];
-      }
+  //We now store the max and min values and the sum for this thread.
+  me = &partials[myid];
+  me->sum = total;
+  me->maxValue = maxValue;
+  me->maxi = maxi;
+  me->maxj = maxj;
+  me->minValue = minValue;
+  me->mini = mini;
+  me->minj = minj;
+
+  if (aggregates) {
+    /* merge everyone's column accumulators, my share of the columns;
+       when the strips are empty the last worker has all the rows */
+    STATS_WAIT(myid, Barrier());
+    s = (cols + numWorkers - 1) / numWorkers;
+    for (j = myid * s; j < cols && j < (myid + 1) * s; j++) {
+      w = (stripSize > 0) ? 0 : numWorkers - 1;
+      colAggs.sum[j] = colPrivate[w].sum[j];
+      colAggs.maxValue[j] = colPrivate[w].maxValue[j];
+      colAggs.maxi[j] = colPrivate[w].maxi[j];
+      colAggs.minValue[j] = colPrivate[w].minValue[j];
+      colAggs.mini[j] = colPrivate[w].mini[j];
+      for (w++; w < numWorkers; w++)
+        columnMerge(&colAggs, j, &colPrivate[w], j);
     }
+  }
+
+  if (numQuantiles > 0) {
+    /* sample my rows, then scan them until worker 0 has found every
+       quantile inside its bracket: once, or twice if one was missed */
+    for (i = first; i <= last; i++)
+      quantileSample(&selection, matrixRow(&matrix, i), cols, (long long) i * cols);
+    STATS_WAIT(myid, Barrier());
+    if (myid == 0) quantilePlan(&selection);
+    STATS_WAIT(myid, Barrier());
+    while (!selection.finished) {
+      for (i = first; i <= last; i++)
+        quantileScan(&selection, myid, matrixRow(&matrix, i), cols);
+      STATS_WAIT(myid, Barrier());
+      if (myid == 0) quantileFinish(&selection);
+      STATS_WAIT(myid, Barrier());
+    }
+  }
+
+  /* merge the subtrees below me, then tell my parent */
+  for (s = 1; s < numWorkers && myid % (2*s) == 0; s *= 2) {
+    if (myid + s >= numWorkers) continue;
+    STATS_WAIT(myid, while (!atomic_load_explicit(&partials[myid + s].ready, memory_order_acquire))
+                       sched_yield());
+    mergePartial(me, &partials[myid + s]);
+  }
+  STATS_END(myid);
+  atomic_store_explicit(&me->ready, 1, memory_order_release);
+
+  if (myid == 0) { //Thread 0 holds the totals of the whole tree
+    total = me->sum;
+    maxValue = me->maxValue;
+    maxi = me->maxi;
+    maxj = me->maxj;
+    minValue = me->minValue;
+    mini = me->mini;
+    minj = me->minj;
     /* get end time */
     end_time = read_timer();
     /* print results */
-    printf("The total is %d\n", total);
+    printf("The total is %lld\n", total);
     printf("The maximum value is %d\n", maxValue);
     printf("Index: row %d, column %d\n", maxi, maxj);
     printf("The minimum value is %d\n", minValue);
     printf("Index row %d, column %d\n", mini, minj);
+    printf("The initialization time is %g sec\n", start_time - init_time);
     printf("The execution time is %g sec\n", end_time - start_time);
+    if (topK > 0) {
+      printTopK("largest", &me->largest);
+      printTopK("smallest", &me->smallest);
+    }
+    if (aggregates) printAggregates();
+    if (numQuantiles > 0) {
+      if (selection.failed)
+        printf("Could not keep the elements inside the brackets of the quantiles\n");
+      else
+        for (i = 0; i < numQuantiles; i++)
+          printf("The %g quantile is %d\n", quantiles[i], selection.value[i]);
+      quantileFree(&selection);
+    }
+    STATS_REPORT(numWorkers, end_time - start_time);
+    matrixFree(&matrix); /* everyone else has finished with it */
   }
 }
@@ -1,29 +1,57 @@
 /* matrix summation using pthreads
 
-   features: uses a barrier; the Worker[0] computes
-             the total sum from partial sums computed by Workers
-             and prints the total sum to the standard output
+   features: every Worker reduces one strip of the matrix and
+             publishes its partial sum, min and max to a result sink
+             (resultSink.h), lock-free by default; main joins the
+             Workers and prints the totals to the standard output
 
    usage under Linux:
-     gcc matrixSum.c -lpthread
-     a.out size numWorkers
+     gcc matrixSumB.c -lpthread
+     a.out size numWorkers [kernel=avx512|avx2|scalar] [huge] [pin] [seed=N]
+       [sink=lockfree|locked]
+
+     compiled with -DINSTRUMENT, also prints per-worker counters (rows,
+     busy, waiting and idle time, cycles, LLC misses) and the imbalance
+     between the workers; see workerStats.h
 
 */
 #ifndef _REENTRANT
 #define _REENTRANT
 #endif
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
 #include <pthread.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <string.h>
 #include <time.h>
 #include <sys/time.h>
-#define MAXSIZE 10000  /* maximum matrix size */
+#include "rowKernel.h"
+#include "matrixBuffer.h"
+#include "resultSink.h"
+#include "workerStats.h"
+#define DEFAULTSIZE 10000  /* matrix size when none is given */
 #define MAXWORKERS 10   /* maximum number of workers */
 
+pthread_mutex_t barrier;  /* mutex lock for the barrier */
+pthread_cond_t go;        /* condition variable for leaving */
 int numWorkers;           /* number of workers */
 int numArrived = 0;       /* number who have arrived */
 
+/* a reusable counter barrier */
+void Barrier() {
+  pthread_mutex_lock(&barrier);
+  numArrived++;
+  if (numArrived == numWorkers) {
+    numArrived = 0;
+    pthread_cond_broadcast(&go);
+  } else
+    pthread_cond_wait(&go, &barrier);
+  pthread_mutex_unlock(&barrier);
+}
+
 /* timer */
 double read_timer() {
     static bool initialized = false;
@@ -38,17 +66,25 @@ double read_timer() {
     return (end.tv_sec - start.tv_sec) + 1.0e-6 * (end.tv_usec - start.tv_usec);
 }
 
-double start_time, end_time; /* start and end times */
+double init_time, start_time, end_time; /* start and end times */
 int size, stripSize;  /* assume size is multiple of numWorkers */
-pthread_mutex_t sumLock, maxLock, minLock;
-int globalSum, globalMax, globalMaxi, globalMaxj, globalMin, globalMini, globalMinj;
-int matrix[MAXSIZE][MAXSIZE]; /* matrix */
+resultSink sink; /* global results, see resultSink.h */
+matrixBuffer matrix; /* matrix */
+bool pinWorkers = false; /* pin each worker to one CPU */
+uint64_t seed = 1; /* selects the random matrix */
 
 void *Worker(void *);
+void printMatrix();
 
 /* read command line, initialize, and create threads */
 int main(int argc, char *argv[]) {
-  int i, j;
+  int i;
+  bool hugePages = false;
+  int sinkKind = SINK_LOCKFREE;
+  long long total;
+  int maxValue, minValue;
+  uint64_t maxIndex, minIndex;
+  const char *kernelName = NULL;
   long l; /* use long in case of a 64-bit system */
   pthread_attr_t attr;
   pthread_t workerid[MAXWORKERS];
@@ -57,41 +93,45 @@ int main(int argc, char *argv[]) {
   pthread_attr_init(&attr);
   pthread_attr_setscope(&attr, PTHREAD_SCOPE_SYSTEM);
 
-  /*initialize all mutexs*/
-  pthread_mutex_init(&sumLock, NULL);
-  pthread_mutex_init(&maxLock, NULL);
-  pthread_mutex_init(&minLock, NULL);
+  /*initialize the barrier*/
+  pthread_mutex_init(&barrier, NULL);
+  pthread_cond_init(&go, NULL);
 
   /* read command line args if any */
-  size = (argc > 1)? atoi(argv[1]) : MAXSIZE;
+  size = (argc > 1)? atoi(argv[1]) : DEFAULTSIZE;
   numWorkers = (argc > 2)? atoi(argv[2]) : MAXWORKERS;
-  if (size > MAXSIZE) size = MAXSIZE;
+  if (size < 1) size = 1;
+  if (numWorkers < 1) numWorkers = 1;
   if (numWorkers > MAXWORKERS) numWorkers = MAXWORKERS;
   stripSize = size/numWorkers;
-
-  /* initialize the matrix */
-  for (i = 0; i < size; i++) {
-	  for (j = 0; j < size; j++) {
-          matrix[i][j] = rand()%1000;
-	  }
+  for (i = 3; i < argc; i++) {
+    if (strncmp(argv[i], "kernel=", 7) == 0)
+      kernelName = argv[i] + 7;
+    else if (strcmp(argv[i], "huge") == 0)
+      hugePages = true;
+    else if (strcmp(argv[i], "pin") == 0)
+      pinWorkers = true;
+    else if (strncmp(argv[i], "seed=", 5) == 0)
+      seed = strtoull(argv[i] + 5, NULL, 10);
+    else if (strcmp(argv[i], "sink=locked") == 0)
+      sinkKind = SINK_LOCKED;
+    else if (strcmp(argv[i], "sink=lockfree") == 0)
+      sinkKind = SINK_LOCKFREE;
   }
-  /*initialize the global variables*/
-  globalMin = matrix[0][0];
-  globalMax = matrix[0][0];
+  rowKernelInit(kernelName);
 
-  /* print the matrix */
-#ifdef DEBUG
-  for (i = 0; i < size; i++) {
-	  printf("[ ");
-	  for (j = 0; j < size; j++) {
-	    printf(" %d", matrix[i][j]);
-	  }
-	  printf(" ]\n");
+  /* allocate the matrix; its pages are placed by the workers */
+  if (!matrixAlloc(&matrix, size, size, hugePages)) {
+    fprintf(stderr, "Could not allocate a %d x %d matrix\n", size, size);
+    return 1;
   }
-#endif
+  if (hugePages)
+    printf("The matrix uses %s\n", matrixKindName(&matrix));
+  if (!sinkInit(&sink, sinkKind, (uint64_t) size * size))
+    printf("The matrix is too large for the lock-free sink, using locks\n");
 
   /* do the parallel work: create the workers */
-  start_time = read_timer();
+  init_time = read_timer();
   for (l = 0; l < numWorkers; l++)
     pthread_create(&workerid[l], &attr, Worker, (void *) l);
   for (i = 0; i < numWorkers; i++)
@@ -100,19 +140,40 @@ int main(int argc, char *argv[]) {
     /* get end time */
   end_time = read_timer();
   /* print results */
-  printf("The total is %d\n", globalSum);
-  printf("The maximum value is %d\n", globalMax);
-  printf("Index: row %d, column %d\n", globalMaxi, globalMaxj);
-  printf("The minimum value is %d\n", globalMin);
-  printf("Index: row %d, column %d\n", globalMini, globalMinj);
+  sinkRead(&sink, &total, &maxValue, &maxIndex, &minValue, &minIndex);
+  printf("The total is %lld\n", total);
+  printf("The maximum value is %d\n", maxValue);
+  printf("Index: row %d, column %d\n", (int) (maxIndex / size), (int) (maxIndex % size));
+  printf("The minimum value is %d\n", minValue);
+  printf("Index: row %d, column %d\n", (int) (minIndex / size), (int) (minIndex % size));
+  printf("The initialization time is %g sec\n", start_time - init_time);
   printf("The execution time is %g sec\n", end_time - start_time);
+  STATS_REPORT(numWorkers, end_time - start_time);
+  matrixFree(&matrix);
+}
+
+/* print the matrix */
+void printMatrix() {
+#ifdef DEBUG
+  int i, j;
+
+  for (i = 0; i < size; i++) {
+	  printf("[ ");
+	  for (j = 0; j < size; j++) {
+	    printf(" %d", matrixRow(&matrix, i)[j]);
+	  }
+	  printf(" ]\n");
+  }
+#endif
 }
 
 /* Each worker sums the values in one strip of the matrix.
    After a barrier, worker(0) computes and prints the total */
 void *Worker(void *arg) {
   long myid = (long) arg;
-  int total, i, j, first, last, maxValue, maxi, maxj, minValue, mini, minj;
+  long long total;
+  rowStats row;
+  int i, first, last, maxValue, maxi, maxj, minValue, mini, minj;
 
 #ifdef DEBUG
   printf("worker %d (pthread id %d) has started\n", myid, pthread_self());
@@ -122,53 +183,43 @@ void *Worker(void *arg) {
   first = myid*stripSize;
   last = (myid == numWorkers - 1) ? (size - 1) : (first + stripSize - 1);
 
+  /* fill my strip, which also places it on my node */
+  if (pinWorkers) pinWorker(myid);
+  matrixFillRows(&matrix, first, last, seed, 1000);
+  Barrier();
+  if (myid == 0) {
+    printMatrix();
+    start_time = read_timer();
+  }
+  Barrier();
+  STATS_BEGIN(myid);
+
   /* sum values in my strip */
   total = 0;
-  maxValue = matrix[first][0];
+  maxValue = matrixRow(&matrix, first)[0];
   maxi = first;
   maxj = 0;
-  minValue = matrix[first][0];
+  minValue = matrixRow(&matrix, first)[0];
   mini = first;
   minj = 0;
-  for (i = first; i <= last; i++)
-    for (j = 0; j < size; j++){
-      total += matrix[i][j];
-      if (maxValue < matrix[i][j]){
-        maxValue = matrix[i][j];
-        maxi = i;
-        maxj = j;
-      }
-      if (minValue > matrix[i][j]){
-        minValue = matrix[i][j];
-        mini = i;
-        minj = j;
-      }
-  }
-
-    //All threads add their sum, min and max induvidally
-    //global variables locked with mutexes
-    pthread_mutex_lock(&sumLock);
-      globalSum += total;
-    pthread_mutex_unlock(&sumLock);
-
-    if (maxValue > globalMax) { //Check if mutex is worth unlocking
-      pthread_mutex_lock(&maxLock);
-      if (maxValue > globalMax){ //Check if value has changed during unlocking
-          globalMax = maxValue;
-          globalMaxi = maxi;
-          globalMaxj = maxj;
-      }
-      pthread_mutex_unlock(&maxLock);
+  for (i = first; i <= last; i++) {
+    rowReduce(matrixRow(&matrix, i), size, &row);
+    STATS_ROWS(myid, 1, size * sizeof(int));
+    total += row.sum;
+    if (maxValue < row.maxValue){
+      maxValue = row.maxValue;
+      maxi = i;
+      maxj = row.maxj;
     }
-
-      if (minValue < globalMin) {
-        printf("Printing shit now\n");
-        pthread_mutex_lock(&minLock);
-        if (minValue < globalMin){
-            globalMin = minValue;
-            globalMini = mini;
-            globalMinj = minj;
-        }
-        pthread_mutex_unlock(&minLock);
+    if (minValue > row.minValue){
+      minValue = row.minValue;
+      mini = i;
+      minj = row.minj;
     }
+  }
+
+  /* publish my results; ties go to the smaller linear index */
+  STATS_WAIT(myid, sinkPublish(&sink, total, maxValue, (uint64_t) maxi * size + maxj,
+                               minValue, (uint64_t) mini * size + minj));
+  STATS_END(myid);
 }
@@ -1,29 +1,70 @@
 /* matrix summation using pthreads
 
-   features: uses a barrier; the Worker[0] computes
-             the total sum from partial sums computed by Workers
-             and prints the total sum to the standard output
+   features: Workers take rows (or tiles) from a bag of tasks until it is
+             empty and publish their partial sum, min and max to a
+             result sink (resultSink.h), lock-free by default; main
+             joins the Workers and prints the totals
 
    usage under Linux:
-     gcc matrixSum.c -lpthread
-     a.out size numWorkers
+     gcc matrixSumC.c -lpthread
+     a.out size|ROWSxCOLS numWorkers [guided|mutex|tiles] [chunk=minRows] [kernel=avx512|avx2|scalar] [huge] [pin] [seed=N]
+       [sink=lockfree|locked]
+
+     compiled with -DINSTRUMENT, also prints per-worker counters (rows,
+     busy, waiting and idle time, cycles, LLC misses) and the imbalance
+     between the workers; see workerStats.h
+
+     guided (default): rows are handed out in chunks by an atomic
+                       dispenser, large chunks first and smaller ones
+                       towards the end (guided scheduling)
+     mutex:            the original bag of tasks, one row per bagLock
+     tiles:            rectangular tiles shaped from the matrix, the
+                       cache size and the number of workers (see
+                       tileScheduler.h), so that short-wide and
+                       tall-skinny matrices keep every worker busy
+
+     ROWSxCOLS, such as 4x2000000, reduces a rectangular matrix
 
 */
 #ifndef _REENTRANT
 #define _REENTRANT
 #endif
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
 #include <pthread.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
 #include <time.h>
 #include <sys/time.h>
-#define MAXSIZE 10000  /* maximum matrix size */
+#include "rowKernel.h"
+#include "matrixBuffer.h"
+#include "resultSink.h"
+#include "workerStats.h"
+#include "tileScheduler.h"
+#define DEFAULTSIZE 10000  /* matrix size when none is given */
 #define MAXWORKERS 10   /* maximum number of workers */
 
+pthread_mutex_t barrier;  /* mutex lock for the barrier */
+pthread_cond_t go;        /* condition variable for leaving */
 int numWorkers;           /* number of workers */
 int numArrived = 0;       /* number who have arrived */
 
+/* a reusable counter barrier */
+void Barrier() {
+  pthread_mutex_lock(&barrier);
+  numArrived++;
+  if (numArrived == numWorkers) {
+    numArrived = 0;
+    pthread_cond_broadcast(&go);
+  } else
+    pthread_cond_wait(&go, &barrier);
+  pthread_mutex_unlock(&barrier);
+}
+
 /* timer */
 double read_timer() {
     static bool initialized = false;
@@ -38,18 +79,34 @@ double read_timer() {
     return (end.tv_sec - start.tv_sec) + 1.0e-6 * (end.tv_usec - start.tv_usec);
 }
 
-double start_time, end_time; /* start and end times */
-int size;
-pthread_mutex_t sumLock, maxLock, minLock, bagLock;
-int globalSum, globalMax, globalMaxi, globalMaxj, globalMin, globalMini, globalMinj;
-int matrix[MAXSIZE][MAXSIZE]; /* matrix */
+double init_time, start_time, end_time; /* start and end times */
+int size;  /* rows */
+int cols;  /* elements per row */
+pthread_mutex_t bagLock;
+resultSink sink; /* global results, see resultSink.h */
+matrixBuffer matrix; /* matrix */
+bool pinWorkers = false; /* pin each worker to one CPU */
+uint64_t seed = 1; /* selects the random matrix */
 int bagOfTasks; /* A bag of tasks from which the threads will pull rows from*/
+atomic_int nextRow; /* first row not yet handed out by the guided dispenser */
+bool guided = true; /* use the guided dispenser instead of the mutex bag */
+int minChunk = 1;   /* smallest chunk the guided dispenser hands out */
+bool tiles = false; /* hand out tiles rather than rows */
+tileScheduler scheduler; /* the tiles */
 
 void *Worker(void *);
+void printMatrix();
+int grabRows(int *);
 
 /* read command line, initialize, and create threads */
 int main(int argc, char *argv[]) {
-  int i, j;
+  int i;
+  bool hugePages = false;
+  int sinkKind = SINK_LOCKFREE;
+  long long total;
+  int maxValue, minValue;
+  uint64_t maxIndex, minIndex;
+  const char *kernelName = NULL;
   long l; /* use long in case of a 64-bit system */
   pthread_attr_t attr;
   pthread_t workerid[MAXWORKERS];
@@ -58,42 +115,64 @@ int main(int argc, char *argv[]) {
   pthread_attr_init(&attr);
   pthread_attr_setscope(&attr, PTHREAD_SCOPE_SYSTEM);
 
-  /*initialize all mutexs*/
-  pthread_mutex_init(&sumLock, NULL);
-  pthread_mutex_init(&maxLock, NULL);
-  pthread_mutex_init(&minLock, NULL);
+  /*initialize the barrier*/
+  pthread_mutex_init(&barrier, NULL);
+  pthread_cond_init(&go, NULL);
   pthread_mutex_init(&bagLock, NULL);
 
   /* read command line args if any */
-  size = (argc > 1)? atoi(argv[1]) : MAXSIZE;
+  size = cols = DEFAULTSIZE;
+  if (argc > 1 && sscanf(argv[1], "%dx%d", &size, &cols) < 2) cols = size;
   numWorkers = (argc > 2)? atoi(argv[2]) : MAXWORKERS;
-  if (size > MAXSIZE) size = MAXSIZE;
+  if (size < 1) size = 1;
+  if (cols < 1) cols = 1;
+  if (numWorkers < 1) numWorkers = 1;
   if (numWorkers > MAXWORKERS) numWorkers = MAXWORKERS;
-
-  /* initialize the matrix */
-  for (i = 0; i < size; i++) {
-	  for (j = 0; j < size; j++) {
-          matrix[i][j] = rand()%1000;
-	  }
+  for (i = 3; i < argc; i++) {
+    if (strcmp(argv[i], "mutex") == 0)
+      guided = tiles = false;
+    else if (strcmp(argv[i], "guided") == 0) {
+      guided = true;
+      tiles = false;
+    } else if (strcmp(argv[i], "tiles") == 0)
+      tiles = true;
+    else if (strncmp(argv[i], "chunk=", 6) == 0)
+      minChunk = atoi(argv[i] + 6);
+    else if (strncmp(argv[i], "kernel=", 7) == 0)
+      kernelName = argv[i] + 7;
+    else if (strcmp(argv[i], "huge") == 0)
+      hugePages = true;
+    else if (strcmp(argv[i], "pin") == 0)
+      pinWorkers = true;
+    else if (strncmp(argv[i], "seed=", 5) == 0)
+      seed = strtoull(argv[i] + 5, NULL, 10);
+    else if (strcmp(argv[i], "sink=locked") == 0)
+      sinkKind = SINK_LOCKED;
+    else if (strcmp(argv[i], "sink=lockfree") == 0)
+      sinkKind = SINK_LOCKFREE;
   }
-  /*initialize the global variables*/
-  globalMin = matrix[0][0];
-  globalMax = matrix[0][0];
+  rowKernelInit(kernelName);
+  if (minChunk < 1) minChunk = 1;
   bagOfTasks = 0;
+  atomic_init(&nextRow, 0);
 
-  /* print the matrix */
-#ifdef DEBUG
-  for (i = 0; i < size; i++) {
-	  printf("[ ");
-	  for (j = 0; j < size; j++) {
-	    printf(" %d", matrix[i][j]);
-	  }
-	  printf(" ]\n");
+  /* allocate the matrix; its pages are placed by the workers */
+  if (!matrixAlloc(&matrix, size, cols, hugePages)) {
+    fprintf(stderr, "Could not allocate a %d x %d matrix\n", size, cols);
+    return 1;
   }
-#endif
+  if (hugePages)
+    printf("The matrix uses %s\n", matrixKindName(&matrix));
+  if (tiles) {
+    tileSchedulerInit(&scheduler, size, cols, numWorkers);
+    printf("The tiles are %d x %d, %d of them\n", scheduler.tileRows, scheduler.tileCols,
+           scheduler.numTiles);
+  }
+  if (!sinkInit(&sink, sinkKind, (uint64_t) size * cols))
+    printf("The matrix is too large for the lock-free sink, using locks\n");
 
   /* do the parallel work: create the workers */
-  start_time = read_timer();
+  init_time = read_timer();
   for (l = 0; l < numWorkers; l++)
     pthread_create(&workerid[l], &attr, Worker, (void *) l);
   for (i = 0; i < numWorkers; i++)
@@ -102,80 +181,136 @@ int main(int argc, char *argv[]) {
     /* get end time */
   end_time = read_timer();
   /* print results */
-  printf("The total is %d\n", globalSum);
-  printf("The maximum value is %d\n", globalMax);
-  printf("Index: row %d, column %d\n", globalMaxi, globalMaxj);
-  printf("The minimum value is %d\n", globalMin);
-  printf("Index: row %d, column %d\n", globalMini, globalMinj);
+  sinkRead(&sink, &total, &maxValue, &maxIndex, &minValue, &minIndex);
+  printf("The total is %lld\n", total);
+  printf("The maximum value is %d\n", maxValue);
+  printf("Index: row %d, column %d\n", (int) (maxIndex / cols), (int) (maxIndex % cols));
+  printf("The minimum value is %d\n", minValue);
+  printf("Index: row %d, column %d\n", (int) (minIndex / cols), (int) (minIndex % cols));
+  printf("The initialization time is %g sec\n", start_time - init_time);
   printf("The execution time is %g sec\n", end_time - start_time);
+  STATS_REPORT(numWorkers, end_time - start_time);
+  matrixFree(&matrix);
+}
+
+/* Guided dispenser: atomically claims the next chunk of rows and stores
+   its first row in *first. Each chunk is the remaining rows divided by
+   twice the number of workers, but never less than minChunk, so chunks
+   start large and shrink towards the end. Returns the number of rows
+   claimed, or 0 when every row has been handed out */
+int grabRows(int *first) {
+  int start, chunk;
+
+  start = atomic_load_explicit(&nextRow, memory_order_relaxed);
+  do {
+    if (start >= size) return 0;
+    chunk = (size - start) / (2*numWorkers);
+    if (chunk < minChunk) chunk = minChunk;
+    if (chunk > size - start) chunk = size - start;
+  } while (!atomic_compare_exchange_weak_explicit(&nextRow, &start, start + chunk,
+                                                  memory_order_relaxed, memory_order_relaxed));
+  *first = start;
+  return chunk;
 }
 
-/* Each worker sums the values in one strip of the matrix.
-   After a barrier, worker(0) computes and prints the total */
+/* print the matrix */
+void printMatrix() {
+#ifdef DEBUG
+  int i, j;
+
+  for (i = 0; i < size; i++) {
+	  printf("[ ");
+	  for (j = 0; j < cols; j++) {
+	    printf(" %d", matrixRow(&matrix, i)[j]);
+	  }
+	  printf(" ]\n");
+  }
+#endif
+}
+
+/* Each worker repeatedly takes rows from the bag of tasks (or chunks of
+   rows from the guided dispenser, or tiles) and adds them to its partial
+   results, which are then published to the result sink. Tiles do not
+   come in row-major order, so ties are settled by the linear index */
 void *Worker(void *arg) {
   long myid = (long) arg;
-  int total, i, j, first, last, maxValue, maxi, maxj, minValue, mini, minj, task;
+  long long total;
+  rowStats row;
+  int i, first, last, c0, c1, maxValue, maxi, maxj, minValue, mini, minj, task, rows;
   bool done = false;
 
 #ifdef DEBUG
   printf("worker %d (pthread id %d) has started\n", myid, pthread_self());
 #endif
 
+  /* fill one strip per worker, which also places it on the worker's
+     node; rows are handed out dynamically afterwards */
+  if (pinWorkers) pinWorker(myid);
+  first = myid*(size/numWorkers);
+  last = (myid == numWorkers - 1) ? (size - 1) : (first + size/numWorkers - 1);
+  matrixFillRows(&matrix, first, last, seed, 1000);
+  Barrier();
+  if (myid == 0) {
+    printMatrix();
+    start_time = read_timer();
+  }
+  Barrier();
+  STATS_BEGIN(myid);
+
   total = 0;
-  maxValue = matrix[0][0];
+  maxValue = matrixRow(&matrix, 0)[0];
   maxi = 0;
   maxj = 0;
-  minValue = matrix[0][0];
+  minValue = matrixRow(&matrix, 0)[0];
   mini = 0;
   minj = 0;
 
+  c0 = 0;
+  c1 = cols - 1;
   while (!done) {
-    /* Grab the next row from the bag of tasks. Every
-    thread work as much as they can, unlike spliting up the work
-    before running*/
-    pthread_mutex_lock(&bagLock);
-      task = bagOfTasks++;
-    pthread_mutex_unlock(&bagLock);
-    if (task < size) done = true;
-
-    for (j = 0; j < size; j++){
-      total += matrix[task][j];
-      if (maxValue < matrix[task][j]){
-        maxValue = matrix[task][j];
-        maxi = task;
-        maxj = j;
-      }
-      if (minValue > matrix[task][j]){
-        minValue = matrix[task][j];
-        mini = task;
-        minj = j;
-      }
+    if (tiles) {
+      STATS_WAIT(myid, rows = tileNext(&scheduler, &first, &last, &c0, &c1) ? last - first + 1 : 0);
+    } else if (guided) {
+      STATS_WAIT(myid, rows = grabRows(&first));
+    } else {
+      /* Grab the next row from the bag of tasks. Every
+      thread work as much as they can, unlike spliting up the work
+      before running*/
+      STATS_WAIT(myid, pthread_mutex_lock(&bagLock));
+        task = bagOfTasks++;
+      pthread_mutex_unlock(&bagLock);
+      first = task;
+      rows = (task < size) ? 1 : 0;
     }
-  }
-
-  pthread_mutex_lock(&sumLock);
-  globalSum += total;
-  pthread_mutex_unlock(&sumLock);
+    if (rows == 0) {
+      done = true;
+      continue;
+    }
+    last = first + rows - 1;
 
-  if (maxValue > globalMax) {
-    pthread_mutex_lock(&maxLock);
-      if (maxValue > globalMax){
-        globalMax = maxValue;
-        globalMaxi = maxi;
-        globalMaxj = maxj;
+    for (i = first; i <= last; i++) {
+      rowReduce(matrixRow(&matrix, i) + c0, c1 - c0 + 1, &row);
+      STATS_ROWS(myid, 1, (c1 - c0 + 1) * sizeof(int));
+      total += row.sum;
+      row.maxj += c0;
+      row.minj += c0;
+      if (maxValue < row.maxValue || (maxValue == row.maxValue
+          && (uint64_t) i * cols + row.maxj < (uint64_t) maxi * cols + maxj)){
+        maxValue = row.maxValue;
+        maxi = i;
+        maxj = row.maxj;
       }
-      pthread_mutex_unlock(&maxLock);
+      if (minValue > row.minValue || (minValue == row.minValue
+          && (uint64_t) i * cols + row.minj < (uint64_t) mini * cols + minj)){
+        minValue = row.minValue;
+        mini = i;
+        minj = row.minj;
       }
-
-  if (minValue < globalMin) {
-    printf("Printing shit now\n");
-    pthread_mutex_lock(&minLock);
-    if (minValue < globalMin){
-      globalMin = minValue;
-      globalMini = mini;
-      globalMinj = minj;
     }
-    pthread_mutex_unlock(&minLock);
   }
 
+  /* publish my results; ties go to the smaller linear index */
+  STATS_WAIT(myid, sinkPublish(&sink, total, maxValue, (uint64_t) maxi * cols + maxj,
+                               minValue, (uint64_t) mini * cols + minj));
+  STATS_END(myid);
 }
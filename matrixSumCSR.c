@@ -0,0 +1,260 @@
+/* sparse matrix summation using pthreads
+
+   features: the matrix is kept in compressed sparse row form (see
+             csrMatrix.h), so memory and time grow with its nonzeros
+             rather than with rows x cols; the rows are split between
+             the Workers by nonzeros, and after a barrier Worker[0]
+             combines the partial results and prints the totals. The
+             minimum and maximum take the implicit zeros into account:
+             a row with fewer nonzeros than columns holds a zero at its
+             first missing column
+
+   usage under Linux:
+     gcc matrixSumCSR.c -lpthread -lm
+     a.out size numWorkers [cols=N] [density=D] [seed=N] [save=path] [pin] [barrier=KIND]
+     a.out 0 numWorkers file=path [pin] [barrier=KIND]
+
+     generates a random size x size (or size x cols) matrix with a
+     fraction D of nonzeros, 0.01 by default, valued 1..1000; save=path
+     also writes it as a Matrix Market file. file=path reduces a
+     coordinate Matrix Market file instead
+
+*/
+#ifndef _REENTRANT
+#define _REENTRANT
+#endif
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include "matrixBuffer.h"
+#include "barrier.h"
+#include "csrMatrix.h"
+#define DEFAULTSIZE 10000  /* matrix size when none is given */
+#define MAXWORKERS 64   /* maximum number of workers */
+
+barrierState barrier;     /* the barrier, of the kind chosen at startup */
+int barrierKindUsed = BARRIER_MUTEX; /* see barrier.h */
+int numWorkers;           /* number of workers */
+
+/* a reusable barrier; myid is the caller's worker number */
+void Barrier(long myid) {
+  barrierWait(&barrier, myid);
+}
+
+/* monotonic timer */
+double read_timer() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + 1.0e-9 * t.tv_nsec;
+}
+
+/* the partial results of one worker, on cache lines of their own;
+   positions are linear indexes (row * cols + column), -1 for none */
+typedef struct {
+  _Alignas(CACHELINE) long long sum;
+  int maxValue, minValue;
+  long long maxIndex, minIndex;
+} partialResult;
+
+double init_time, start_time, end_time; /* start and end times */
+csrMatrix matrix;         /* matrix */
+bool generate;            /* make the matrix rather than read it */
+double density = 0.01;    /* fraction of nonzeros when generating */
+uint64_t seed = 1;        /* selects the random matrix */
+const char *savePath = NULL; /* where to write the generated matrix */
+bool pinWorkers = false;  /* pin each worker to one CPU */
+partialResult partials[MAXWORKERS];
+
+void *Worker(void *);
+
+/* read command line, initialize, and create threads */
+int main(int argc, char *argv[]) {
+  int i, size, cols;
+  const char *path = NULL;
+  long l; /* use long in case of a 64-bit system */
+  pthread_attr_t attr;
+  pthread_t workerid[MAXWORKERS];
+
+  /* set global thread attributes */
+  pthread_attr_init(&attr);
+  pthread_attr_setscope(&attr, PTHREAD_SCOPE_SYSTEM);
+
+  /* read command line args if any */
+  size = (argc > 1)? atoi(argv[1]) : DEFAULTSIZE;
+  numWorkers = (argc > 2)? atoi(argv[2]) : MAXWORKERS;
+  if (size < 1) size = 1;
+  if (numWorkers < 1) numWorkers = 1;
+  if (numWorkers > MAXWORKERS) numWorkers = MAXWORKERS;
+  cols = size;
+  for (i = 3; i < argc; i++) {
+    if (strncmp(argv[i], "cols=", 5) == 0)
+      cols = atoi(argv[i] + 5);
+    else if (strncmp(argv[i], "density=", 8) == 0)
+      density = atof(argv[i] + 8);
+    else if (strncmp(argv[i], "seed=", 5) == 0)
+      seed = strtoull(argv[i] + 5, NULL, 10);
+    else if (strncmp(argv[i], "save=", 5) == 0)
+      savePath = argv[i] + 5;
+    else if (strncmp(argv[i], "file=", 5) == 0)
+      path = argv[i] + 5;
+    else if (strcmp(argv[i], "pin") == 0)
+      pinWorkers = true;
+    else if (strncmp(argv[i], "barrier=", 8) == 0) {
+      barrierKindUsed = barrierKind(argv[i] + 8);
+      if (barrierKindUsed < 0) {
+        fprintf(stderr, "unknown barrier %s\n", argv[i] + 8);
+        return 1;
+      }
+    }
+  }
+  if (cols < 1) cols = 1;
+  if (!barrierInit(&barrier, barrierKindUsed, numWorkers)) {
+    fprintf(stderr, "Could not set up the barrier\n");
+    return 1;
+  }
+
+  init_time = read_timer();
+  if (path != NULL) {
+    if (!csrLoadMatrixMarket(path, &matrix)) return 1;
+    generate = false;
+  } else {
+    /* the workers count and fill their rows */
+    if (!csrAllocRows(&matrix, size, cols)) {
+      fprintf(stderr, "Could not allocate a %d x %d matrix\n", size, cols);
+      return 1;
+    }
+    generate = true;
+  }
+
+  /* do the parallel work: the main thread is Worker[0] */
+  for (l = 1; l < numWorkers; l++)
+    pthread_create(&workerid[l], &attr, Worker, (void *) l);
+  Worker((void *) 0);
+  for (l = 1; l < numWorkers; l++)
+    pthread_join(workerid[l], NULL);
+  if (savePath != NULL && !csrWriteMatrixMarket(savePath, &matrix)) return 1;
+  csrFree(&matrix);
+  return 0;
+}
+
+/* Worker[0]: the counts of all rows are in; make room for the nonzeros */
+void allocNonzeros() {
+  if (!csrAllocNonzeros(&matrix)) {
+    fprintf(stderr, "Could not allocate %lld nonzeros\n", matrix.nnz);
+    exit(1);
+  }
+}
+
+/* add value at linear index idx to p; ties go to the smaller index */
+static inline void consider(partialResult *p, int value, long long idx) {
+  if (p->maxIndex < 0 || value > p->maxValue || (value == p->maxValue && idx < p->maxIndex)) {
+    p->maxValue = value;
+    p->maxIndex = idx;
+  }
+  if (p->minIndex < 0 || value < p->minValue || (value == p->minValue && idx < p->minIndex)) {
+    p->minValue = value;
+    p->minIndex = idx;
+  }
+}
+
+/* Sum the rows first..last into p. The nonzeros of a row are in
+   column order, so the first missing column is found on the way */
+void reduceRows(partialResult *p, int first, int last) {
+  const long long *rowPtr = matrix.rowPtr;
+  const int *colIdx = matrix.colIdx, *values = matrix.values;
+  long long k, sum = 0, base;
+  int i, expected, gap, maxValue, minValue, v;
+  long long maxk, mink;
+
+  for (i = first; i <= last; i++) {
+    base = (long long) i * matrix.cols;
+    expected = 0;
+    gap = -1;
+    if (rowPtr[i] < rowPtr[i + 1]) {
+      maxk = mink = rowPtr[i];
+      maxValue = minValue = values[maxk];
+      for (k = rowPtr[i]; k < rowPtr[i + 1]; k++) {
+        v = values[k];
+        sum += v;
+        if (v > maxValue) {
+          maxValue = v;
+          maxk = k;
+        }
+        if (v < minValue) {
+          minValue = v;
+          mink = k;
+        }
+        if (gap < 0 && colIdx[k] > expected) gap = expected;
+        expected = colIdx[k] + 1;
+      }
+      consider(p, maxValue, base + colIdx[maxk]);
+      consider(p, minValue, base + colIdx[mink]);
+    }
+    /* the first implicit zero of the row, if it has one */
+    if (gap < 0 && expected < matrix.cols) gap = expected;
+    if (gap >= 0) consider(p, 0, base + gap);
+  }
+  p->sum += sum;
+}
+
+/* Each worker builds its strip of rows if the matrix is generated, then
+   sums its share of the nonzeros. After a barrier, Worker[0] combines
+   the partial results and prints them */
+void *Worker(void *arg) {
+  long myid = (long) arg;
+  partialResult *me = &partials[myid], *p;
+  int i, first, last, stripSize;
+
+  if (pinWorkers) pinWorker(myid);
+  if (generate) {
+    /* count, then fill, my strip of rows; this also places the rows
+       on my node */
+    stripSize = matrix.rows / numWorkers;
+    first = myid*stripSize;
+    last = (myid == numWorkers - 1) ? (matrix.rows - 1) : (first + stripSize - 1);
+    csrGenerateRows(&matrix, first, last, density, seed, false);
+    Barrier(myid);
+    if (myid == 0) allocNonzeros();
+    Barrier(myid);
+    csrGenerateRows(&matrix, first, last, density, seed, true);
+  }
+  Barrier(myid);
+  if (myid == 0) start_time = read_timer();
+  Barrier(myid);
+
+  /* my rows hold about nnz/numWorkers nonzeros */
+  first = csrFirstRow(&matrix, (int) myid, numWorkers);
+  last = csrFirstRow(&matrix, (int) myid + 1, numWorkers) - 1;
+  me->sum = 0;
+  me->maxIndex = me->minIndex = -1;
+  reduceRows(me, first, last);
+  Barrier(myid);
+
+  if (myid == 0) {
+    for (i = 1; i < numWorkers; i++) {
+      p = &partials[i];
+      me->sum += p->sum;
+      if (p->maxIndex >= 0) consider(me, p->maxValue, p->maxIndex);
+      if (p->minIndex >= 0) consider(me, p->minValue, p->minIndex);
+    }
+    /* get end time */
+    end_time = read_timer();
+    /* print results */
+    printf("The matrix is %d x %d with %lld nonzeros (%.4g%%)\n", matrix.rows, matrix.cols,
+           matrix.nnz, 100.0 * matrix.nnz / ((double) matrix.rows * matrix.cols));
+    printf("The total is %lld\n", me->sum);
+    printf("The maximum value is %d\n", me->maxValue);
+    printf("Index: row %lld, column %lld\n", me->maxIndex / matrix.cols, me->maxIndex % matrix.cols);
+    printf("The minimum value is %d\n", me->minValue);
+    printf("Index: row %lld, column %lld\n", me->minIndex / matrix.cols, me->minIndex % matrix.cols);
+    printf("The initialization time is %g sec\n", start_time - init_time);
+    printf("The execution time is %g sec\n", end_time - start_time);
+  }
+  return NULL;
+}
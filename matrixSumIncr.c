@@ -0,0 +1,297 @@
+/* matrix statistics kept up to date under updates, using pthreads
+
+   features: the workers fill the matrix and build a tree of block
+             summaries (blockStats.h) in one parallel pass; after that
+             Worker[0] reads updates from the standard input and collects
+             them into a batch, and on "stats" recomputes only the blocks
+             the batch touched and their ancestors. Batches touching many
+             blocks are recomputed by all workers, small ones by Worker[0]
+             alone, so that fresh statistics take microseconds rather
+             than a pass over the matrix
+
+   usage under Linux:
+     gcc matrixSumIncr.c -lpthread
+     a.out size numWorkers [kernel=avx512|avx2|scalar] [huge] [pin] [seed=N]
+       [barrier=KIND] < updates
+
+   one command per line of input:
+     cell i j value    set element (i, j) to value
+     row i value       set every element of row i to value
+     random n [seed]   set n random elements to random values
+     stats             apply the batch and print the statistics; so
+                       does the end of the input
+     check             apply the batch and compare the statistics with
+                       a full pass over the matrix
+     quit              stop
+
+*/
+#ifndef _REENTRANT
+#define _REENTRANT
+#endif
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include "rowKernel.h"
+#include "matrixBuffer.h"
+#include "barrier.h"
+#include "blockStats.h"
+#define DEFAULTSIZE 10000  /* matrix size when none is given */
+#define MAXWORKERS 64   /* maximum number of workers */
+#define MAXLINE 4096    /* longest command line */
+#define PARALLELBLOCKS 256 /* fewest marked blocks worth waking the workers for */
+
+barrierState barrier;     /* the barrier, of the kind chosen at startup */
+int barrierKindUsed = BARRIER_MUTEX; /* see barrier.h */
+int numWorkers;           /* number of workers */
+
+/* a reusable barrier; myid is the caller's worker number */
+void Barrier(long myid) {
+  barrierWait(&barrier, myid);
+}
+
+/* monotonic timer */
+double read_timer() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + 1.0e-9 * t.tv_nsec;
+}
+
+double start_time;        /* when the recomputation of the batch began */
+int size, stripSize;
+matrixBuffer matrix;      /* matrix */
+blockStats stats;         /* summaries of its blocks */
+bool pinWorkers = false;  /* pin each worker to one CPU */
+uint64_t seed = 1;        /* selects the random matrix */
+bool quit = false;        /* no more commands */
+bool inputDone = false;   /* the input has ended or said quit */
+bool check;               /* compare the batch's result with a full pass */
+long long updates;        /* elements changed by the current batch */
+
+void *Worker(void *);
+void finishBatch();
+
+/* read command line, initialize, and run the workers */
+int main(int argc, char *argv[]) {
+  int i;
+  bool hugePages = false;
+  const char *kernelName = NULL;
+  long l; /* use long in case of a 64-bit system */
+  pthread_attr_t attr;
+  pthread_t workerid[MAXWORKERS];
+
+  /* set global thread attributes */
+  pthread_attr_init(&attr);
+  pthread_attr_setscope(&attr, PTHREAD_SCOPE_SYSTEM);
+
+  /* read command line args if any */
+  size = (argc > 1)? atoi(argv[1]) : DEFAULTSIZE;
+  numWorkers = (argc > 2)? atoi(argv[2]) : MAXWORKERS;
+  if (size < 1) size = 1;
+  if (numWorkers < 1) numWorkers = 1;
+  if (numWorkers > MAXWORKERS) numWorkers = MAXWORKERS;
+  stripSize = size/numWorkers;
+  for (i = 3; i < argc; i++) {
+    if (strncmp(argv[i], "kernel=", 7) == 0)
+      kernelName = argv[i] + 7;
+    else if (strcmp(argv[i], "huge") == 0)
+      hugePages = true;
+    else if (strcmp(argv[i], "pin") == 0)
+      pinWorkers = true;
+    else if (strncmp(argv[i], "seed=", 5) == 0)
+      seed = strtoull(argv[i] + 5, NULL, 10);
+    else if (strncmp(argv[i], "barrier=", 8) == 0) {
+      barrierKindUsed = barrierKind(argv[i] + 8);
+      if (barrierKindUsed < 0) {
+        fprintf(stderr, "unknown barrier %s\n", argv[i] + 8);
+        return 1;
+      }
+    }
+  }
+  rowKernelInit(kernelName);
+  if (!barrierInit(&barrier, barrierKindUsed, numWorkers)) {
+    fprintf(stderr, "Could not set up the barrier\n");
+    return 1;
+  }
+
+  /* allocate the matrix and its summaries; pages are placed by the workers */
+  if (!matrixAlloc(&matrix, size, size, hugePages) || !blockStatsInit(&stats, size, size)) {
+    fprintf(stderr, "Could not allocate a %d x %d matrix\n", size, size);
+    return 1;
+  }
+  if (hugePages)
+    printf("The matrix uses %s\n", matrixKindName(&matrix));
+
+  /* the main thread is Worker[0] */
+  for (l = 1; l < numWorkers; l++)
+    pthread_create(&workerid[l], &attr, Worker, (void *) l);
+  Worker((void *) 0);
+  for (l = 1; l < numWorkers; l++)
+    pthread_join(workerid[l], NULL);
+  blockStatsFree(&stats);
+  matrixFree(&matrix);
+  return 0;
+}
+
+/* Worker[0]: print the statistics at the root */
+void printStats(const char *what, double seconds) {
+  const blockSummary *s = blockStatsTotal(&stats);
+
+  printf("%s: total %lld max %d at (%d, %d) min %d at (%d, %d) in %g us\n",
+         what, s->sum, s->maxValue, s->maxRow, s->maxCol,
+         s->minValue, s->minRow, s->minCol, 1e6 * seconds);
+  fflush(stdout);
+}
+
+/* Worker[0]: compare the root with a full pass over the matrix */
+void checkStats() {
+  const blockSummary *s = blockStatsTotal(&stats);
+  rowStats row;
+  long long total = 0;
+  int i, maxValue, maxi = 0, maxj = 0, minValue, mini = 0, minj = 0;
+
+  maxValue = minValue = matrixRow(&matrix, 0)[0];
+  for (i = 0; i < size; i++) {
+    rowReduce(matrixRow(&matrix, i), size, &row);
+    total += row.sum;
+    if (maxValue < row.maxValue) {
+      maxValue = row.maxValue;
+      maxi = i;
+      maxj = row.maxj;
+    }
+    if (minValue > row.minValue) {
+      minValue = row.minValue;
+      mini = i;
+      minj = row.minj;
+    }
+  }
+  if (total == s->sum && maxValue == s->maxValue && maxi == s->maxRow && maxj == s->maxCol
+      && minValue == s->minValue && mini == s->minRow && minj == s->minCol)
+    printf("check: the statistics match a full pass\n");
+  else
+    printf("check: MISMATCH, a full pass gives total %lld max %d at (%d, %d) min %d at (%d, %d)\n",
+           total, maxValue, maxi, maxj, minValue, mini, minj);
+  fflush(stdout);
+}
+
+/* Worker[0]: read commands, applying the updates to the matrix and
+   marking their blocks, until the batch has to be recomputed. Small
+   batches are recomputed here; returns when the batch is large enough
+   for every worker to help, or at the end of the input (quit set) */
+void readBatch() {
+  char line[MAXLINE];
+  int i, j, value;
+  long long n, k;
+  unsigned long long s;
+  int fields;
+
+  while (true) {
+    inputDone = inputDone || fgets(line, sizeof(line), stdin) == NULL
+                || strncmp(line, "quit", 4) == 0;
+    if (inputDone && stats.numDirty == 0) {
+      quit = true;
+      return;
+    }
+    check = false;
+    if (!inputDone) {
+      if (sscanf(line, " cell %d %d %d", &i, &j, &value) == 3) {
+        if (i < 0 || i >= size || j < 0 || j >= size) {
+          fprintf(stderr, "no element (%d, %d)\n", i, j);
+          continue;
+        }
+        matrixRow(&matrix, i)[j] = value;
+        blockStatsMark(&stats, i, j);
+        updates++;
+        continue;
+      }
+      if (sscanf(line, " row %d %d", &i, &value) == 2) {
+        if (i < 0 || i >= size) {
+          fprintf(stderr, "no row %d\n", i);
+          continue;
+        }
+        for (j = 0; j < size; j++)
+          matrixRow(&matrix, i)[j] = value;
+        blockStatsMarkRow(&stats, i);
+        updates += size;
+        continue;
+      }
+      if ((fields = sscanf(line, " random %lld %llu", &n, &s)) >= 1) {
+        if (fields < 2) s = seed + 1;
+        for (k = 0; k < n; k++) {
+          i = (int) ((counterRng(s, (uint64_t) k, 0) >> 32) * size >> 32);
+          j = (int) ((counterRng(s, (uint64_t) k, 1) >> 32) * size >> 32);
+          matrixRow(&matrix, i)[j] = (int) ((counterRng(s, (uint64_t) k, 2) >> 32) * 1000 >> 32);
+          blockStatsMark(&stats, i, j);
+        }
+        updates += n;
+        continue;
+      }
+      check = strncmp(line, "check", 5) == 0;
+      if (!check && strncmp(line, "stats", 5) != 0) continue; /* blank line or comment */
+    }
+
+    /* recompute the batch, with every worker if it is large */
+    start_time = read_timer();
+    if (stats.numDirty >= PARALLELBLOCKS && numWorkers > 1) return;
+    blockStatsRefreshLeaves(&stats, &matrix, 0, stats.numDirty - 1);
+    finishBatch();
+  }
+}
+
+/* Worker[0]: once the marked leaves are recomputed, recompute their
+   ancestors and print the statistics */
+void finishBatch() {
+  char what[64];
+
+  snprintf(what, sizeof(what), "%lld updates, %d blocks", updates, stats.numDirty);
+  blockStatsRefreshTree(&stats);
+  printStats(what, read_timer() - start_time);
+  if (check) checkStats();
+  updates = 0;
+}
+
+/* Each worker fills its strip and computes the summaries of its
+   blocks, then Worker[0] builds the rest of the tree. After that the
+   workers wait while Worker[0] reads updates, and share the
+   recomputation of every batch that touches many blocks */
+void *Worker(void *arg) {
+  long myid = (long) arg;
+  int first, last, share;
+
+  /* determine first and last rows of my strip */
+  first = myid*stripSize;
+  last = (myid == numWorkers - 1) ? (size - 1) : (first + stripSize - 1);
+
+  /* fill my strip, which also places it on my node */
+  if (pinWorkers) pinWorker(myid);
+  matrixFillRows(&matrix, first, last, seed, 1000);
+  Barrier(myid);
+  if (myid == 0) start_time = read_timer();
+  Barrier(myid);
+  blockStatsBuildRows(&stats, &matrix, first, last);
+  Barrier(myid);
+  if (myid == 0) {
+    blockStatsBuildTree(&stats);
+    printStats("build", read_timer() - start_time);
+  }
+
+  while (true) {
+    if (myid == 0) readBatch();
+    Barrier(myid);
+    if (quit) break;
+
+    /* recompute my share of the marked blocks */
+    share = (stats.numDirty + numWorkers - 1) / numWorkers;
+    first = myid * share;
+    last = (first + share - 1 < stats.numDirty - 1) ? first + share - 1 : stats.numDirty - 1;
+    blockStatsRefreshLeaves(&stats, &matrix, first, last);
+    Barrier(myid);
+    if (myid == 0) finishBatch();
+  }
+  return NULL;
+}
@@ -0,0 +1,323 @@
+/* matrix summation server using a persistent pool of pthreads
+
+   features: the workers are created once and reduce one job after
+             another, meeting at a reusable barrier (barrier.h, as in
+             matrixSum.c) between the phases of every job; Worker[0]
+             reads the next job from the standard input, combines the
+             partial results, prints them, and at the end of the input
+             prints percentiles of the per-job latencies
+
+   usage under Linux:
+     gcc matrixSumPool.c -lpthread
+     a.out numWorkers [kernel=avx512|avx2|scalar] [huge] [pin] [barrier=KIND] < jobs
+
+   one job per line of input (a UNIX socket can be attached with socat):
+     size [seed]       reduce a size x size random matrix (as matrixSumA)
+     file path         reduce a matrix file written by matrixGen
+     quit              stop; so does the end of the input
+
+*/
+#ifndef _REENTRANT
+#define _REENTRANT
+#endif
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+#include "rowKernel.h"
+#include "matrixBuffer.h"
+#include "barrier.h"
+#include "matrixFile.h"
+#define MAXWORKERS 64   /* maximum number of workers */
+#define MAXLINE 4096    /* longest job line */
+
+barrierState barrier;     /* the barrier, of the kind chosen at startup */
+int barrierKindUsed = BARRIER_MUTEX; /* see barrier.h */
+int numWorkers;           /* number of workers */
+
+/* a reusable barrier; myid is the caller's worker number */
+void Barrier(long myid) {
+  barrierWait(&barrier, myid);
+}
+
+/* timer */
+double read_timer() {
+    static bool initialized = false;
+    static struct timeval start;
+    struct timeval end;
+    if( !initialized )
+    {
+        gettimeofday( &start, NULL );
+        initialized = true;
+    }
+    gettimeofday( &end, NULL );
+    return (end.tv_sec - start.tv_sec) + 1.0e-6 * (end.tv_usec - start.tv_usec);
+}
+
+/* the job all workers are on, set up by Worker[0] */
+bool quit = false;        /* no more jobs */
+bool generate;            /* fill the matrix from seed rather than a file */
+uint64_t seed;            /* selects the random matrix */
+int rows, cols, stripSize;
+matrixBuffer matrix;      /* matrix of the current job */
+bool hugePages = false;   /* back generated matrices with huge pages */
+bool pinWorkers = false;  /* pin each worker to one CPU */
+
+long long sums[MAXWORKERS]; /* partial sums */
+int maxValues[MAXWORKERS], maxIndexesi[MAXWORKERS], maxIndexesj[MAXWORKERS];
+int minValues[MAXWORKERS], minIndexesi[MAXWORKERS], minIndexesj[MAXWORKERS];
+
+double job_time, start_time; /* when the job was read and when reducing began */
+double *latencies, *reduceTimes; /* per job, in seconds */
+int numJobs, maxJobs;
+
+void *Worker(void *);
+
+/* read command line and run the pool */
+int main(int argc, char *argv[]) {
+  int i;
+  const char *kernelName = NULL;
+  long l; /* use long in case of a 64-bit system */
+  pthread_attr_t attr;
+  pthread_t workerid[MAXWORKERS];
+
+  /* set global thread attributes */
+  pthread_attr_init(&attr);
+  pthread_attr_setscope(&attr, PTHREAD_SCOPE_SYSTEM);
+
+  /* read command line args if any */
+  numWorkers = (argc > 1)? atoi(argv[1]) : MAXWORKERS;
+  if (numWorkers < 1) numWorkers = 1;
+  if (numWorkers > MAXWORKERS) numWorkers = MAXWORKERS;
+  for (i = 2; i < argc; i++) {
+    if (strncmp(argv[i], "kernel=", 7) == 0)
+      kernelName = argv[i] + 7;
+    else if (strcmp(argv[i], "huge") == 0)
+      hugePages = true;
+    else if (strcmp(argv[i], "pin") == 0)
+      pinWorkers = true;
+    else if (strncmp(argv[i], "barrier=", 8) == 0) {
+      barrierKindUsed = barrierKind(argv[i] + 8);
+      if (barrierKindUsed < 0) {
+        fprintf(stderr, "unknown barrier %s\n", argv[i] + 8);
+        return 1;
+      }
+    }
+  }
+  rowKernelInit(kernelName);
+  if (!barrierInit(&barrier, barrierKindUsed, numWorkers)) {
+    fprintf(stderr, "Could not set up the barrier\n");
+    return 1;
+  }
+  matrix.data = NULL;
+
+  /* start the pool; the main thread is Worker[0] */
+  for (l = 1; l < numWorkers; l++)
+    pthread_create(&workerid[l], &attr, Worker, (void *) l);
+  Worker((void *) 0);
+  for (l = 1; l < numWorkers; l++)
+    pthread_join(workerid[l], NULL);
+  matrixFree(&matrix);
+  return 0;
+}
+
+/* Set up the matrix for a job of rows x cols; reuses the current buffer
+   when it is large enough. Returns false if there is no memory */
+bool prepareMatrix(int r, int c) {
+  size_t perLine = CACHELINE / sizeof(int);
+  size_t stride = (c + perLine - 1) / perLine * perLine;
+
+  if (matrix.data != NULL && matrix.kind != MATRIX_FILE
+      && (size_t) r * stride * sizeof(int) <= matrix.bytes) {
+    matrix.rows = r;
+    matrix.cols = c;
+    matrix.stride = stride;
+    return true;
+  }
+  matrixFree(&matrix);
+  return matrixAlloc(&matrix, r, c, hugePages);
+}
+
+/* Worker[0]: read lines until one holds a job, and set it up.
+   Sets quit at the end of the input; reads nothing once quit is set */
+void readJob() {
+  char line[MAXLINE], path[MAXLINE];
+  long long n;
+  unsigned long long s;
+  int fields;
+
+  while (!quit && fgets(line, sizeof(line), stdin) != NULL) {
+    job_time = read_timer();
+    if (sscanf(line, " file %4095s", path) == 1) {
+      matrixFree(&matrix);
+      if (!matrixFileMap(path, &matrix)) continue;
+      generate = false;
+      rows = matrix.rows;
+      cols = matrix.cols;
+      return;
+    }
+    if (strncmp(line, "quit", 4) == 0) break;
+    fields = sscanf(line, "%lld %llu", &n, &s);
+    if (fields < 1) continue; /* blank line or comment */
+    if (n < 1 || n > 1000000) {
+      fprintf(stderr, "bad job: %s", line);
+      continue;
+    }
+    seed = (fields > 1) ? s : 1;
+    if (!prepareMatrix((int) n, (int) n)) {
+      fprintf(stderr, "Could not allocate a %lld x %lld matrix\n", n, n);
+      continue;
+    }
+    generate = true;
+    rows = cols = (int) n;
+    return;
+  }
+  quit = true;
+}
+
+/* Worker[0]: combine the partial results, print them and record the
+   latency of the job. If there is no memory to record it, stops taking
+   jobs by setting quit */
+void finishJob() {
+  int i, maxValue, maxi, maxj, minValue, mini, minj, newMax;
+  long long total;
+  double end_time = read_timer(), *t;
+
+  total = 0;
+  maxValue = maxValues[0];
+  maxi = maxIndexesi[0];
+  maxj = maxIndexesj[0];
+  minValue = minValues[0];
+  mini = minIndexesi[0];
+  minj = minIndexesj[0];
+  for (i = 0; i < numWorkers; i++) {
+    total += sums[i];
+    if (maxValue < maxValues[i]){
+      maxValue = maxValues[i];
+      maxi = maxIndexesi[i];
+      maxj = maxIndexesj[i];
+    }
+    if (minValue > minValues[i]){
+      minValue = minValues[i];
+      mini = minIndexesi[i];
+      minj = minIndexesj[i];
+    }
+  }
+
+  printf("job %d: %d x %d total %lld max %d at (%d, %d) min %d at (%d, %d)"
+         " latency %g ms (reduction %g ms)\n",
+         numJobs + 1, rows, cols, total, maxValue, maxi, maxj, minValue, mini, minj,
+         1e3 * (end_time - job_time), 1e3 * (end_time - start_time));
+  fflush(stdout);
+
+  if (numJobs == maxJobs) {
+    newMax = maxJobs ? 2*maxJobs : 1024;
+    if ((t = realloc(latencies, newMax * sizeof(double))) != NULL)
+      latencies = t;
+    if (t != NULL && (t = realloc(reduceTimes, newMax * sizeof(double))) != NULL)
+      reduceTimes = t;
+    if (t == NULL) {
+      fprintf(stderr, "Could not record the latencies of more than %d jobs; stopping\n", numJobs);
+      quit = true;
+      return;
+    }
+    maxJobs = newMax;
+  }
+  latencies[numJobs] = end_time - job_time;
+  reduceTimes[numJobs] = end_time - start_time;
+  numJobs++;
+}
+
+int compareDoubles(const void *a, const void *b) {
+  double x = *(const double *) a, y = *(const double *) b;
+  return (x > y) - (x < y);
+}
+
+/* index of percentile p of n sorted values, by nearest rank: the
+   ceil(p/100 n)-th smallest, as in matrixBench.c */
+int nearestRank(int p, int n) {
+  return (int) (((long long) p * n + 99) / 100) - 1;
+}
+
+/* print the percentiles of n times, in milliseconds */
+void printPercentiles(const char *what, double *t, int n) {
+  qsort(t, n, sizeof(double), compareDoubles);
+  printf("%s (ms): p50 %g p90 %g p99 %g max %g\n", what,
+         1e3 * t[nearestRank(50, n)], 1e3 * t[nearestRank(90, n)],
+         1e3 * t[nearestRank(99, n)], 1e3 * t[n - 1]);
+}
+
+/* Every job: Worker[0] reads it, each worker fills (if generated) and
+   reduces its strip, and Worker[0] combines the partial results. The
+   barriers separate the phases, so the workers are never re-created */
+void *Worker(void *arg) {
+  long myid = (long) arg;
+  long long total;
+  rowStats row;
+  int i, first, last, maxValue, maxi, maxj, minValue, mini, minj;
+
+  if (pinWorkers) pinWorker(myid);
+  while (true) {
+    if (myid == 0) {
+      readJob();
+      stripSize = rows/numWorkers;
+    }
+    Barrier(myid);
+    if (quit) break;
+
+    /* determine first and last rows of my strip */
+    first = myid*stripSize;
+    last = (myid == numWorkers - 1) ? (rows - 1) : (first + stripSize - 1);
+    if (generate)
+      matrixFillRows(&matrix, first, last, seed, 100);
+    Barrier(myid);
+    if (myid == 0) start_time = read_timer();
+
+    /* reduce my strip; an empty strip reports the first element */
+    total = 0;
+    maxValue = minValue = matrixRow(&matrix, 0)[0];
+    maxi = mini = 0;
+    maxj = minj = 0;
+    if (first <= last) {
+      maxValue = minValue = matrixRow(&matrix, first)[0];
+      maxi = mini = first;
+    }
+    for (i = first; i <= last; i++) {
+      matrixFileStream(&matrix, first, last, i);
+      rowReduce(matrixRow(&matrix, i), cols, &row);
+      total += row.sum;
+      if (maxValue < row.maxValue){
+        maxValue = row.maxValue;
+        maxi = i;
+        maxj = row.maxj;
+      }
+      if (minValue > row.minValue){
+        minValue = row.minValue;
+        mini = i;
+        minj = row.minj;
+      }
+    }
+    maxValues[myid] = maxValue;
+    maxIndexesi[myid] = maxi;
+    maxIndexesj[myid] = maxj;
+    minValues[myid] = minValue;
+    minIndexesi[myid] = mini;
+    minIndexesj[myid] = minj;
+    sums[myid] = total;
+    Barrier(myid);
+    if (myid == 0) finishJob();
+  }
+
+  if (myid == 0 && numJobs > 0) {
+    printf("%d jobs\n", numJobs);
+    printPercentiles("latency", latencies, numJobs);
+    printPercentiles("reduction", reduceTimes, numJobs);
+  }
+  return NULL;
+}
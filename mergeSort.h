@@ -0,0 +1,131 @@
+/* parallel merge sort of ints
+
+   mergeSortWorker sorts r->a[0..n-1]; every worker of a pool calls it
+   with its own id. Each worker first sorts a chunk of n/numWorkers keys
+   by itself with r->sortChunk. Then the sorted runs are merged in pairs,
+   log2 numWorkers levels of them, between a and a second buffer of the
+   same size (ping-pong), with a barrier between levels.
+
+   Every level, the top one included, is shared by all the workers:
+   worker w writes the w-th numWorkers-th of the output of the level.
+   Where its share of the output of a merge of runs A and B starts and
+   ends is found by co-ranking: for an output position k, the binary
+   search of mergeCoRank finds the i + j = k such that the first k keys
+   of the merge are A[0..i-1] and B[0..j-1]. So no worker waits for a
+   merge bigger than its share, and the span of a level is n/numWorkers
+   plus a binary search.
+
+   The merge is stable: equal keys of A come before those of B.
+
+*/
+#ifndef MERGESORT_H
+#define MERGESORT_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include "barrier.h"
+
+typedef struct {
+  int *a, *tmp;          /* the keys and a buffer as large */
+  long n;
+  int numWorkers;
+  barrierState *barrier; /* for numWorkers threads */
+  bool ownsTmp;          /* tmp was allocated by mergeInit */
+  void (*sortChunk)(int *, int); /* sorts one worker's chunk */
+} mergeSorter;
+
+/* Set r up to sort a[0..n-1] with numWorkers workers waiting on
+   barrier, each sorting its chunk with sortChunk, using tmp, of n ints
+   or more, as the second buffer; with tmp NULL, allocates one. Returns
+   false without memory */
+static inline bool mergeInit(mergeSorter *r, int *a, long n, int numWorkers, barrierState *barrier,
+                             void (*sortChunk)(int *, int), int *tmp) {
+  r->a = a;
+  r->n = n;
+  r->numWorkers = numWorkers;
+  r->barrier = barrier;
+  r->sortChunk = sortChunk;
+  r->ownsTmp = tmp == NULL;
+  r->tmp = (tmp != NULL) ? tmp : malloc((n > 0 ? n : 1) * sizeof(int));
+  return r->tmp != NULL;
+}
+
+static inline void mergeFree(mergeSorter *r) {
+  if (r->ownsTmp) free(r->tmp);
+  r->tmp = NULL;
+}
+
+/* first key of chunk c */
+static inline long mergeChunkStart(const mergeSorter *r, long c) {
+  return r->n * c / r->numWorkers;
+}
+
+/* How many of the first k keys of the stable merge of A[0..m-1] and
+   B[0..n-1] come from A */
+static inline long mergeCoRank(long k, const int *A, long m, const int *B, long n) {
+  long lo = (k > n) ? k - n : 0, hi = (k < m) ? k : m, i;
+
+  /* the smallest i for which A[i] does not belong among the first k */
+  while (lo < hi) {
+    i = lo + (hi - lo) / 2;
+    if (i < m && k - i > 0 && A[i] <= B[k - i - 1])
+      lo = i + 1;
+    else
+      hi = i;
+  }
+  return lo;
+}
+
+/* merge A[0..m-1] and B[0..n-1] into out, A first on equal keys */
+static inline void mergeRuns(const int *A, long m, const int *B, long n, int *out) {
+  long i = 0, j = 0, k = 0;
+
+  while (i < m && j < n)
+    out[k++] = (B[j] < A[i]) ? B[j++] : A[i++];
+  while (i < m)
+    out[k++] = A[i++];
+  while (j < n)
+    out[k++] = B[j++];
+}
+
+/* Sort r->a; every worker of the pool calls this with its own id */
+static inline void mergeSortWorker(mergeSorter *r, long myid) {
+  int p = r->numWorkers, *src = r->a, *dst = r->tmp, *t;
+  long width, q, first, middle, last, o0, o1, lo, hi, i0, i1;
+  long mine0 = mergeChunkStart(r, myid), mine1 = mergeChunkStart(r, myid + 1);
+
+  r->sortChunk(r->a + mine0, (int) (mine1 - mine0));
+  barrierWait(r->barrier, myid);
+
+  /* runs of width chunks are merged in pairs into runs of 2 * width */
+  for (width = 1; width < p; width *= 2) {
+    for (q = 0; q < p; q += 2 * width) {
+      first = mergeChunkStart(r, q);
+      middle = mergeChunkStart(r, (q + width < p) ? q + width : p);
+      last = mergeChunkStart(r, (q + 2 * width < p) ? q + 2 * width : p);
+
+      /* my share of the output, where it overlaps this merge */
+      o0 = (mine0 > first) ? mine0 : first;
+      o1 = (mine1 < last) ? mine1 : last;
+      if (o0 >= o1) continue;
+      lo = o0 - first;
+      hi = o1 - first;
+      i0 = mergeCoRank(lo, src + first, middle - first, src + middle, last - middle);
+      i1 = mergeCoRank(hi, src + first, middle - first, src + middle, last - middle);
+      mergeRuns(src + first + i0, i1 - i0, src + middle + (lo - i0), (hi - i1) - (lo - i0), dst + o0);
+    }
+    barrierWait(r->barrier, myid);
+    t = src;
+    src = dst;
+    dst = t;
+  }
+
+  /* an odd number of levels leaves the keys in tmp */
+  if (src != r->a) {
+    memcpy(r->a + mine0, src + mine0, (mine1 - mine0) * sizeof(int));
+    barrierWait(r->barrier, myid);
+  }
+}
+
+#endif /* MERGESORT_H */
@@ -0,0 +1,354 @@
+/* parallel selection of quantiles of ints, without sorting
+
+   The key of quantile q of n keys is the one of rank floor(q * (n-1))
+   in sorted order: q = 0.5 is the (lower) median, 0 the minimum and 1
+   the maximum. Up to QUANTILE_MAX quantiles are found together, in
+   about one pass over the keys, which may be split into segments of any
+   size (the rows of a matrix, the chunks of an array), each handed to
+   one worker.
+
+   As in Floyd-Rivest selection, a random sample picks the pivots. Every
+   worker first draws its share of QUANTILE_SAMPLE keys from its
+   segments with quantileSample; worker 0 sorts them, and quantilePlan
+   brackets each wanted rank by QUANTILE_SPREAD sample positions either
+   side. The standard deviation of where the wanted key falls in the
+   sample is at most sqrt(QUANTILE_SAMPLE / 4) = 128 positions, at the
+   median, and less towards the ends, so a bracket is 5 standard
+   deviations or more either side: keys lo <= hi that the wanted key
+   lies between unless the sample was very unlucky. Then quantileScan
+   counts, for every quantile, the keys below lo, equal to lo and equal
+   to hi, and copies out the few strictly between them (about 2% of the
+   keys per quantile); quantileFinish, on worker 0, finds the wanted key
+   among the copies by quickselect with the caller's partition step.
+
+   If the wanted key was outside a bracket, quantileFinish widens that
+   bracket to everything on the side where the key is and leaves
+   finished false, so the workers scan again; the second pass is sure to
+   find it. Keys equal to lo or hi are only counted, so many repeats of
+   one value cost no copies.
+
+*/
+#ifndef QUANTILES_H
+#define QUANTILES_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <limits.h>
+#include "barrier.h"
+#include "counterRng.h"
+
+#define QUANTILE_MAX 16       /* most quantiles in one selection */
+#define QUANTILE_SAMPLE 65536 /* keys sampled to place the brackets */
+#define QUANTILE_SPREAD 640   /* half a bracket, in sample positions */
+#define QUANTILE_ROOM 1024    /* first copies kept per quantile */
+#define QUANTILE_BLOCK 1024   /* keys scanned for one quantile at a time */
+
+/* the counts and copies of one worker, by quantile */
+typedef struct {
+  _Alignas(BARRIER_LINE) long long below[QUANTILE_MAX]; /* keys < lo */
+  long long atLo[QUANTILE_MAX], atHi[QUANTILE_MAX];     /* keys == lo, keys == hi */
+  int *inside[QUANTILE_MAX];                            /* keys strictly between */
+  long long count[QUANTILE_MAX], room[QUANTILE_MAX];    /* in inside */
+  bool failed;                                          /* out of memory */
+} quantileScratch;
+
+typedef struct {
+  int numQuantiles;
+  double q[QUANTILE_MAX];
+  long long rank[QUANTILE_MAX];   /* of the wanted keys */
+  int lo[QUANTILE_MAX], hi[QUANTILE_MAX]; /* their brackets */
+  bool found[QUANTILE_MAX];
+  int value[QUANTILE_MAX];        /* the wanted keys, once found */
+  long long total;                /* keys in all the segments */
+  int numWorkers;
+  uint64_t seed;
+  int *sample;                    /* the sampled keys */
+  long long samples;
+  quantileScratch *scratch;       /* one per worker */
+  void (*partition)(int *, int *, int, int, int, int *, int *);
+  bool finished;                  /* every quantile is found, or failed */
+  bool failed;                    /* out of memory, or too many copies */
+  int passes;                     /* scans so far */
+} quantileSelector;
+
+/* Partition a[first..last] three ways around a[p]: on return
+   a[first..*lt-1] < pivot, a[*lt..*gt] == pivot and a[*gt+1..last] >
+   pivot. The partition step for callers that have none of their own;
+   perm is not used */
+static inline void quantilePartition(int *a, int *perm, int first, int last, int p, int *lt, int *gt) {
+  int i = first, pivot = a[p], x;
+
+  (void) perm;
+  *lt = first;
+  *gt = last;
+  while (i <= *gt) {
+    x = a[i];
+    if (x < pivot) {
+      a[i++] = a[*lt];
+      a[(*lt)++] = x;
+    } else if (x > pivot) {
+      a[i] = a[*gt];
+      a[(*gt)--] = x;
+    } else
+      i++;
+  }
+}
+
+/* Set s up to find the quantiles q[0..numQuantiles-1] of total keys
+   with numWorkers workers, drawing the sample from seed. partition
+   must leave a[first..*lt-1] < pivot, a[*lt..*gt] == pivot and
+   a[*gt+1..last] >= pivot, as the kernels of quickSort.c do; NULL
+   takes quantilePartition. Returns false without memory */
+static inline bool quantileInit(quantileSelector *s, const double *q, int numQuantiles, long long total,
+                                int numWorkers, uint64_t seed,
+                                void (*partition)(int *, int *, int, int, int, int *, int *)) {
+  int j;
+
+  s->numQuantiles = (numQuantiles < QUANTILE_MAX) ? numQuantiles : QUANTILE_MAX;
+  for (j = 0; j < s->numQuantiles; j++) {
+    s->q[j] = q[j];
+    s->rank[j] = (total > 0) ? (long long) (q[j] * (total - 1)) : 0;
+    s->found[j] = false;
+    s->value[j] = 0;
+  }
+  s->total = total;
+  s->numWorkers = numWorkers;
+  s->seed = seed;
+  s->partition = (partition != NULL) ? partition : quantilePartition;
+  s->finished = total < 1;
+  s->failed = false;
+  s->passes = 0;
+
+  /* a small input is copied whole rather than sampled */
+  s->samples = (total > 4 * (long long) QUANTILE_SAMPLE) ? QUANTILE_SAMPLE : 0;
+  s->sample = malloc((s->samples > 0 ? s->samples : 1) * sizeof(int));
+  s->scratch = barrierAlloc(numWorkers * sizeof(quantileScratch));
+  if (s->scratch != NULL)
+    memset(s->scratch, 0, numWorkers * sizeof(quantileScratch));
+  return s->sample != NULL && s->scratch != NULL;
+}
+
+static inline void quantileFree(quantileSelector *s) {
+  int w, j;
+
+  if (s->scratch != NULL)
+    for (w = 0; w < s->numWorkers; w++)
+      for (j = 0; j < QUANTILE_MAX; j++)
+        free(s->scratch[w].inside[j]);
+  free(s->sample);
+  barrierRelease(s->scratch);
+  s->sample = NULL;
+  s->scratch = NULL;
+}
+
+/* Draw the share of the sample of the segment a[0..n-1], whose first
+   key is key number base of all of them. The shares of all segments
+   fill the sample exactly, so every worker can do its own */
+static inline void quantileSample(quantileSelector *s, const int *a, long n, long long base) {
+  long long t, first, last;
+
+  if (s->samples == 0 || n < 1) return;
+  first = base * s->samples / s->total;
+  last = (base + n) * s->samples / s->total;
+  for (t = first; t < last; t++)
+    s->sample[t] = a[counterRng(s->seed, (uint64_t) base, (uint64_t) t) % (uint64_t) n];
+}
+
+static int quantileCompare(const void *a, const void *b) {
+  int x = *(const int *) a, y = *(const int *) b;
+  return (x > y) - (x < y);
+}
+
+/* forget the counts and copies of the last pass */
+static inline void quantileReset(quantileSelector *s) {
+  int w, j;
+
+  for (w = 0; w < s->numWorkers; w++)
+    for (j = 0; j < QUANTILE_MAX; j++)
+      s->scratch[w].below[j] = s->scratch[w].atLo[j] = s->scratch[w].atHi[j] = s->scratch[w].count[j] = 0;
+}
+
+/* Worker 0, once every worker has drawn its sample: bracket each
+   quantile */
+static inline void quantilePlan(quantileSelector *s) {
+  long long r;
+  int j;
+
+  qsort(s->sample, s->samples, sizeof(int), quantileCompare);
+  for (j = 0; j < s->numQuantiles; j++) {
+    s->lo[j] = INT_MIN;
+    s->hi[j] = INT_MAX;
+    if (s->samples == 0) continue;
+    r = (long long) (s->q[j] * (s->samples - 1));
+    if (r - QUANTILE_SPREAD >= 0) s->lo[j] = s->sample[r - QUANTILE_SPREAD];
+    if (r + QUANTILE_SPREAD < s->samples) s->hi[j] = s->sample[r + QUANTILE_SPREAD];
+  }
+  quantileReset(s);
+}
+
+/* make room for need copies of quantile j; false without memory */
+static inline bool quantileRoom(quantileScratch *me, int j, long long need) {
+  long long room = (me->room[j] > 0) ? me->room[j] : QUANTILE_ROOM;
+  int *p;
+
+  if (need <= me->room[j]) return true;
+  while (room < need)
+    room *= 2;
+  p = realloc(me->inside[j], room * sizeof(int));
+  if (p == NULL) {
+    me->failed = true;
+    return false;
+  }
+  me->inside[j] = p;
+  me->room[j] = room;
+  return true;
+}
+
+/* Count and copy out the keys of the segment a[0..n-1] against the
+   brackets of the quantiles not found yet, for worker myid. A block of
+   keys at a time is done for each quantile in turn, without branches:
+   every key is written after the copies, but only those inside the
+   bracket advance the count */
+static inline void quantileScan(quantileSelector *s, long myid, const int *a, long n) {
+  quantileScratch *me = &s->scratch[myid];
+  long long below, atLo, atHi, c;
+  long b, i, e;
+  int j, x, lo, hi, distinct, *keep;
+
+  for (b = 0; b < n; b = e) {
+    e = (n - b < QUANTILE_BLOCK) ? n : b + QUANTILE_BLOCK;
+    for (j = 0; j < s->numQuantiles; j++) {
+      if (s->found[j]) continue;
+      if (!quantileRoom(me, j, me->count[j] + (e - b))) return;
+      lo = s->lo[j];
+      hi = s->hi[j];
+      distinct = hi != lo;
+      keep = me->inside[j];
+      c = me->count[j];
+      below = atLo = atHi = 0;
+      for (i = b; i < e; i++) {
+        x = a[i];
+        below += x < lo;
+        atLo += x == lo;
+        atHi += (x == hi) & distinct;
+        keep[c] = x;
+        c += (x > lo) & (x < hi);
+      }
+      me->count[j] = c;
+      me->below[j] += below;
+      me->atLo[j] += atLo;
+      me->atHi[j] += atHi;
+    }
+  }
+}
+
+/* the key of rank k of a[0..n-1], moving the keys about. The pivot is
+   the median of three keys at positions drawn from seed, so that no
+   order of the keys, such as the one a partition step leaves behind,
+   makes it slow */
+static inline int quantileKth(int *a, int n, int k, uint64_t seed,
+                              void (*partition)(int *, int *, int, int, int, int *, int *)) {
+  int first = 0, last = n - 1, i, j, m, p, lt, gt;
+  uint64_t round = 0, r;
+
+  while (first < last) {
+    r = counterRng(seed, round++, 0);
+    i = first + (int) ((r & 0xffffffff) % (uint64_t) (last - first + 1));
+    j = first + (int) ((r >> 32) % (uint64_t) (last - first + 1));
+    m = first + (int) (counterRng(seed, round, 1) % (uint64_t) (last - first + 1));
+    if (a[i] < a[j])
+      p = (a[j] < a[m]) ? j : (a[i] < a[m]) ? m : i;
+    else
+      p = (a[i] < a[m]) ? i : (a[j] < a[m]) ? m : j;
+    partition(a, NULL, first, last, p, &lt, &gt);
+    if (k < lt)
+      last = lt - 1;
+    else if (k > gt)
+      first = gt + 1;
+    else
+      return a[k];
+  }
+  return a[k];
+}
+
+/* Worker 0, once every worker has scanned all its segments: find the
+   wanted keys inside their brackets, and widen the brackets of those
+   that were outside. Returns, and sets, finished: false if the workers
+   have to scan again */
+static inline bool quantileFinish(quantileSelector *s) {
+  long long below, atLo, atHi, m, k;
+  quantileScratch *first = &s->scratch[0];
+  int *keys;
+  int w, j;
+
+  s->passes++;
+  for (w = 0; w < s->numWorkers; w++)
+    s->failed = s->failed || s->scratch[w].failed;
+  for (j = 0; j < s->numQuantiles && !s->failed; j++) {
+    if (s->found[j]) continue;
+    below = atLo = atHi = m = 0;
+    for (w = 0; w < s->numWorkers; w++) {
+      below += s->scratch[w].below[j];
+      atLo += s->scratch[w].atLo[j];
+      atHi += s->scratch[w].atHi[j];
+      m += s->scratch[w].count[j];
+    }
+    k = s->rank[j] - below;
+    if (k < 0) {
+      /* below the bracket: lo > INT_MIN, since keys are below it */
+      s->hi[j] = s->lo[j] - 1;
+      s->lo[j] = INT_MIN;
+    } else if (k < atLo) {
+      s->value[j] = s->lo[j];
+      s->found[j] = true;
+    } else if (k - atLo < m) {
+      /* gather everyone's copies after worker 0's */
+      if (m > INT_MAX || (keys = realloc(first->inside[j], m * sizeof(int))) == NULL) {
+        s->failed = true;
+        break;
+      }
+      first->inside[j] = keys;
+      first->room[j] = m;
+      for (w = 1; w < s->numWorkers; w++) {
+        if (s->scratch[w].count[j] == 0) continue; /* inside may be NULL */
+        memcpy(keys + first->count[j], s->scratch[w].inside[j], s->scratch[w].count[j] * sizeof(int));
+        first->count[j] += s->scratch[w].count[j];
+      }
+      s->value[j] = quantileKth(keys, (int) m, (int) (k - atLo), s->seed + j, s->partition);
+      s->found[j] = true;
+    } else if (k - atLo - m < atHi) {
+      s->value[j] = s->hi[j];
+      s->found[j] = true;
+    } else {
+      /* above the bracket: hi < INT_MAX, since keys are above it */
+      s->lo[j] = s->hi[j] + 1;
+      s->hi[j] = INT_MAX;
+    }
+  }
+
+  s->finished = true;
+  for (j = 0; j < s->numQuantiles; j++)
+    s->finished = s->finished && s->found[j];
+  s->finished = s->finished || s->failed;
+  quantileReset(s);
+  return s->finished;
+}
+
+/* Parse a comma separated list of at most QUANTILE_MAX quantiles, each
+   from 0 to 1. Returns how many there were, 0 if one was bad */
+static inline int quantileParse(const char *s, double *q) {
+  int n = 0;
+  char *end;
+
+  while (n < QUANTILE_MAX) {
+    q[n] = strtod(s, &end);
+    if (end == s || !(q[n] >= 0 && q[n] <= 1)) return 0;
+    n++;
+    if (*end != ',') break;
+    s = end + 1;
+  }
+  return n;
+}
+
+#endif /* QUANTILES_H */
@@ -1,33 +1,145 @@
-/* matrix summation using pthreads
+/* parallel quicksort using a pool of pthreads
 
-   features: uses a barrier; the Worker[0] computes
-             the total sum from partial sums computed by Workers
-             and prints the total sum to the standard output
+   features: a fixed pool of workers, one per core by default; every
+             worker owns a deque of partitions, pushes and pops at the
+             bottom of its own deque and steals from the top of the
+             others when it runs dry; partitions smaller than the
+             cutoff are sorted sequentially by the worker that holds them.
+             Pivots are the median of 3 elements, or the ninther of 9
+             for large partitions; partitions are split three ways so
+             that keys equal to the pivot are done at once; ranges of
+             INSERTIONCUTOFF elements or fewer are insertion sorted; and a
+             partition that has been split 2 log2 n times without getting
+             small is heapsorted, so the worst case is O(n log n)
+
+   partition kernels:
+     block     BlockQuicksort: elements are classified a block at a time
+               into buffers of offsets without branches, and the
+               misplaced ones swapped in pairs; a range whose predecessor
+               equals the pivot puts the keys equal to it on the left,
+               where they are done (as in pdqsort). The default
+     dutch     Dijkstra's three-way partition, one branch per element
+
+   sort engines:
+     quick     the quicksort above. The default
+     radix     parallel radix sort on 8-bit digits (see radixSort.h);
+               its result is checked against the quicksort of a copy
+     merge     parallel merge sort (see mergeSort.h): every worker
+               sorts a chunk, then all of them share every level of
+               merges, split by co-ranking; also checked against
+               quicksort
+   radix and merge need a second buffer as large as the keys, which is
+   allocated, and its pages faulted in, before the timer starts
+
+   records (quicksort only):
+     argsort       sorts the keys and a permutation alongside them, so
+                   that perm[i] is where the i-th smallest key was
+     payload=BYTES sorts records of a key and BYTES bytes of payload:
+                   the keys are sorted contiguously with a permutation,
+                   which is applied once at the end, so every record
+                   moves once instead of on every swap
+
+   files:
+     save=PATH     also writes the generated keys to PATH as raw ints
+     external=PATH sorts the raw ints of the file PATH, which may be
+                   larger than memory, into output=PATH (PATH.sorted by
+                   default): runs that fit in memory=MB megabytes (256
+                   by default; half of that for radix and merge, which
+                   need a second buffer) are sorted by the chosen engine
+                   and merged in one pass (see externalSort.h), with the
+                   temporary runs in tmpdir=DIR (/tmp by default)
+
+   selection:
+     quantiles=Q,... finds the keys of the quantiles Q (from 0 to 1, so
+                   0.5,0.9,0.99 are the median, p90 and p99) without
+                   sorting: a sample brackets each of them, one parallel
+                   pass counts the keys below the brackets and copies out
+                   those inside, and quickselect with the partition
+                   kernel finds them among the copies (see quantiles.h).
+                   The keys are then sorted by the chosen engine to check
+                   them and to compare the times
 
    usage under Linux:
-     gcc matrixSum.c -lpthread
-     a.out size numWorkers
+     gcc -O2 quickSort.c -lpthread
+     a.out [numElements] [numWorkers] [cutoff] [kernel=block|dutch]
+       [sort=quick|radix|merge] [barrier=KIND] [argsort] [payload=BYTES]
+       [save=PATH] [external=PATH [output=PATH] [memory=MB] [tmpdir=DIR]]
+       [quantiles=Q,...]
+       [bench=partition|sort] [sizes=N,...] [workers=N,...]
+       [dists=NAME,...] [engines=NAME,...] [trials=N] [seed=N]
+
+     bench=partition times one partition of numElements random 32-bit
+     keys with every kernel, trials times each (11 by default), and
+     prints CSV
+
+     bench=sort times every engine on every distribution, size and
+     worker count, trials times each (5 by default), and prints the
+     median and best times, elements per second and the speedup over
+     the qsort of the C library as CSV. Every result is compared with
+     the one of qsort, which checks both that it is sorted and that it
+     holds the same keys; the exit code is 1 if one is not. Sizes
+     default to 1000,100000,10000000 and workers to 1, 2, 4, ... up to
+     the number of cores. It times the keys alone: argsort and payload
+     are not benchmarked. The distributions:
+       uniform    random 32-bit keys
+       sorted     0, 1, 2, ...
+       reverse    n, n-1, ...
+       equal      every key the same
+       fewunique  rand()%1000 like the default input: 1000 values
+       organpipe  rising to the middle, then falling
+       zipf       Zipf-like (s = 1): the bit length of a key is uniform
+                  in 1..30, so key 1 is a thirtieth of all keys
 
 */
 #ifndef _REENTRANT
 #define _REENTRANT
 #endif
 #include <pthread.h>
+#include <sched.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <unistd.h>
 #include <time.h>
 #include <sys/time.h>
-#define MAXELEMENTS 200
+#include "counterRng.h"
+#include "barrier.h"
+#include "radixSort.h"
+#include "externalSort.h"
+#include "mergeSort.h"
+#include "quantiles.h"
+#define DEFAULTELEMENTS 200 /* number of elements when none is given */
+#define DEFAULTCUTOFF 4096  /* partitions this small are sorted sequentially */
+#define MAXWORKERS 64       /* maximum number of workers */
+#define DEQUESIZE 128       /* partitions a worker can have waiting */
+#define INSERTIONCUTOFF 24  /* ranges this small are insertion sorted */
+#define NINTHERSIZE 128     /* ranges this large take the ninther as pivot */
+#define BLOCKSIZE 64        /* elements classified at a time by the block kernel */
+#define DEFAULTTRIALS 11    /* timed partitions per kernel in the benchmark */
+#define DEFAULTSORTTRIALS 5 /* timed sorts per case in the sort benchmark */
+#define MAXSWEEP 32         /* most sizes or worker counts in a sweep */
+#define DEFAULTMEMORY 256   /* megabytes of keys per run of the external sort */
 
 /* Define a struct model to define what data will be be
 transmitted between threads and recursive function calls */
 typedef struct {
   int* a;
+  int* perm; /* moved along with a, or NULL */
   int first;
   int last;
+  int depth; /* splits left before falling back to heapsort */
 } structArray;
 
+/* A worker's deque of partitions. The owner pushes and pops at the
+bottom, thieves take the oldest (and largest) partition from the top */
+typedef struct {
+  pthread_mutex_t lock;
+  structArray tasks[DEQUESIZE];
+  atomic_int top, bottom; /* written under lock; atomic so thieves can peek */
+} taskDeque;
+
 /* timer */
 double read_timer() {
     static bool initialized = false;
@@ -43,25 +155,215 @@ double read_timer() {
 }
 
 double start_time, end_time; /* start and end times */
-int arrayOfElements[MAXELEMENTS]; /* Array to sort */
-int count; /* Counter for the number of Threads created */
-pthread_mutex_t thready; /* Locks for count */
+int *arrayOfElements; /* Array to sort */
+int numWorkers; /* number of workers in the pool */
+int cutoff; /* sequential cutoff */
+taskDeque deques[MAXWORKERS]; /* one deque per worker */
+atomic_long pendingTasks; /* partitions pushed but not yet fully sorted */
+barrierState barrier;     /* for the engines that work in phases */
+int barrierKindUsed = BARRIER_MUTEX; /* see barrier.h */
+radixSorter radix;        /* state of the radix sort */
+mergeSorter merger;       /* state of the merge sort */
+int *spare;               /* radix, merge: their second buffer, kept between sorts */
+long spareInts;           /* its size */
+const char *gatherFrom;   /* payload: the records in their first order */
+char *gatherTo;           /* payload: the records in sorted order */
+const int *gatherPerm;    /* payload: where each sorted record comes from */
+size_t recordBytes;       /* payload: bytes in a record */
+int gatherCount;          /* payload: records to move */
+quantileSelector selection; /* state of the quantile selection */
+const int *selectKeys;    /* quantiles: the keys */
+int selectCount;          /* quantiles: how many */
+
+void partitionBlock(int *, int *, int, int, int, int *, int *);
+void partitionDutch(int *, int *, int, int, int, int *, int *);
+
+/* the partition kernels, by name; partition is the one in use */
+#define KERNELS 2
+const char *kernelNames[KERNELS] = { "block", "dutch" };
+void (*kernels[KERNELS])(int *, int *, int, int, int, int *, int *) = { partitionBlock, partitionDutch };
+void (*partition)(int *, int *, int, int, int, int *, int *) = partitionBlock;
+
+void quickSort(int *, int);
+void quickSortWith(int *, int *, int);
+void radixSort(int *, int);
+void mergeSort(int *, int);
+
+/* the sort engines, by name; sort is the one in use */
+#define ENGINES 3
+const char *engineNames[ENGINES] = { "quick", "radix", "merge" };
+void (*engines[ENGINES])(int *, int) = { quickSort, radixSort, mergeSort };
+void (*sort)(int *, int) = quickSort;
+
+/* the input distributions of the sort benchmark */
+#define DISTS 7
+const char *distNames[DISTS] = { "uniform", "sorted", "reverse", "equal", "fewunique", "organpipe", "zipf" };
 
-void* quickSort(void *);
+void benchPartition(int, int, uint64_t);
+int benchSort(const int *, int, const int *, int, const int *, int, const int *, int, int, uint64_t);
+int parseList(const char *, int *);
+int parseNames(const char *, const char **, int, int *);
+int sortRecords(int, int);
+bool reserveSpare(long);
+int sortFile(const char *, const char *, const char *, long);
+int findQuantiles(int, const double *, int, uint64_t);
+void *Worker(void *);
+void *RadixWorker(void *);
+void *MergeWorker(void *);
+void *GatherWorker(void *);
+void *SelectWorker(void *);
 
-/* read command line, initialize, and create threads */
+/* read command line, initialize, and sort */
 int main(int argc, char *argv[]) {
-  long l; /* use long in case of a 64-bit system */
-  int i;
-  structArray list;
+  long l = DEFAULTELEMENTS; /* use long in case of a 64-bit system */
+  int i, k, positional = 0, trials = 0;
+  bool bench = false, benchSorts = false, argsort = false;
+  int sizes[MAXSWEEP], workers[MAXSWEEP], dists[DISTS], sorts[ENGINES];
+  int numSizes = 3, numCounts = 0, numDists = DISTS, numSorts = ENGINES, w, cores;
+  uint64_t seed = 1;
+  int payloadBytes = 0, numQuantiles = 0;
+  double quantiles[QUANTILE_MAX];
+  const char *savePath = NULL, *inPath = NULL, *outPath = NULL, *tmpdir = "/tmp";
+  long memoryMB = DEFAULTMEMORY;
+  char defaultOut[4096];
+  FILE *f;
+  int *copy;
+  double check_time;
 
-  l = MAXELEMENTS; /* Set the number of elements in the array */
-  count = 0;
+  numWorkers = cores = (int) sysconf(_SC_NPROCESSORS_ONLN);
+  cutoff = DEFAULTCUTOFF;
+  sizes[0] = 1000;
+  sizes[1] = 100000;
+  sizes[2] = 10000000;
+  for (w = 1; w < cores && w < MAXWORKERS && numCounts < MAXSWEEP - 1; w *= 2)
+    workers[numCounts++] = w;
+  workers[numCounts++] = (cores < MAXWORKERS) ? cores : MAXWORKERS;
+  for (k = 0; k < DISTS; k++)
+    dists[k] = k;
+  for (k = 0; k < ENGINES; k++)
+    sorts[k] = k;
+  for (i = 1; i < argc; i++) {
+    if (strncmp(argv[i], "kernel=", 7) == 0) {
+      for (k = 0; k < KERNELS && strcmp(argv[i] + 7, kernelNames[k]) != 0; k++)
+        ;
+      if (k == KERNELS) {
+        fprintf(stderr, "unknown kernel %s\n", argv[i] + 7);
+        return 1;
+      }
+      partition = kernels[k];
+    } else if (strncmp(argv[i], "sort=", 5) == 0) {
+      for (k = 0; k < ENGINES && strcmp(argv[i] + 5, engineNames[k]) != 0; k++)
+        ;
+      if (k == ENGINES) {
+        fprintf(stderr, "unknown sort %s\n", argv[i] + 5);
+        return 1;
+      }
+      sort = engines[k];
+    } else if (strncmp(argv[i], "barrier=", 8) == 0) {
+      barrierKindUsed = barrierKind(argv[i] + 8);
+      if (barrierKindUsed < 0) {
+        fprintf(stderr, "unknown barrier %s\n", argv[i] + 8);
+        return 1;
+      }
+    } else if (strcmp(argv[i], "argsort") == 0)
+      argsort = true;
+    else if (strncmp(argv[i], "payload=", 8) == 0)
+      payloadBytes = atoi(argv[i] + 8);
+    else if (strncmp(argv[i], "save=", 5) == 0)
+      savePath = argv[i] + 5;
+    else if (strncmp(argv[i], "external=", 9) == 0)
+      inPath = argv[i] + 9;
+    else if (strncmp(argv[i], "output=", 7) == 0)
+      outPath = argv[i] + 7;
+    else if (strncmp(argv[i], "memory=", 7) == 0)
+      memoryMB = atol(argv[i] + 7);
+    else if (strncmp(argv[i], "tmpdir=", 7) == 0)
+      tmpdir = argv[i] + 7;
+    else if (strncmp(argv[i], "quantiles=", 10) == 0) {
+      numQuantiles = quantileParse(argv[i] + 10, quantiles);
+      if (numQuantiles == 0) {
+        fprintf(stderr, "bad quantiles %s: up to %d of them, each from 0 to 1\n", argv[i] + 10, QUANTILE_MAX);
+        return 1;
+      }
+    }
+    else if (strcmp(argv[i], "bench=partition") == 0)
+      bench = true;
+    else if (strcmp(argv[i], "bench=sort") == 0)
+      benchSorts = true;
+    else if (strncmp(argv[i], "sizes=", 6) == 0)
+      numSizes = parseList(argv[i] + 6, sizes);
+    else if (strncmp(argv[i], "workers=", 8) == 0)
+      numCounts = parseList(argv[i] + 8, workers);
+    else if (strncmp(argv[i], "dists=", 6) == 0)
+      numDists = parseNames(argv[i] + 6, distNames, DISTS, dists);
+    else if (strncmp(argv[i], "engines=", 8) == 0)
+      numSorts = parseNames(argv[i] + 8, engineNames, ENGINES, sorts);
+    else if (strncmp(argv[i], "trials=", 7) == 0)
+      trials = atoi(argv[i] + 7);
+    else if (strncmp(argv[i], "seed=", 5) == 0)
+      seed = strtoull(argv[i] + 5, NULL, 10);
+    else {
+      if (positional == 0)
+        l = atol(argv[i]); /* Set the number of elements in the array */
+      else if (positional == 1)
+        numWorkers = atoi(argv[i]);
+      else if (positional == 2)
+        cutoff = atoi(argv[i]);
+      positional++;
+    }
+  }
+  if (l < 1) l = 1;
+  if (numWorkers < 1) numWorkers = 1;
+  if (numWorkers > MAXWORKERS) numWorkers = MAXWORKERS;
+  if (cutoff < 1) cutoff = 1;
+  if (trials < 1) trials = benchSorts ? DEFAULTSORTTRIALS : DEFAULTTRIALS;
+  if (payloadBytes < 0) payloadBytes = 0;
+  if ((argsort || payloadBytes > 0) && sort != quickSort) {
+    fprintf(stderr, "argsort and payload work with sort=quick only\n");
+    return 1;
+  }
+  if (memoryMB < 1) memoryMB = 1;
+  if (bench) {
+    benchPartition(l, trials, seed);
+    return 0;
+  }
+  if (benchSorts) {
+    if (numSizes == 0 || numCounts == 0 || numDists == 0 || numSorts == 0) {
+      fprintf(stderr, "sizes, workers, dists and engines need at least one good entry each\n");
+      return 1;
+    }
+    return benchSort(sizes, numSizes, workers, numCounts, dists, numDists, sorts, numSorts,
+                     trials, seed);
+  }
+  if (inPath != NULL) {
+    if (outPath == NULL) {
+      snprintf(defaultOut, sizeof(defaultOut), "%s.sorted", inPath);
+      outPath = defaultOut;
+    }
+    return sortFile(inPath, outPath, tmpdir, memoryMB);
+  }
 
+  arrayOfElements = malloc(l * sizeof(int));
+  if (arrayOfElements == NULL) {
+    fprintf(stderr, "Could not allocate %ld elements\n", l);
+    return 1;
+  }
   for(i = 0; i < l; i++){
     arrayOfElements[i] = rand()%1000;
   }
 
+  if (savePath != NULL) {
+    f = fopen(savePath, "wb");
+    if (f == NULL || fwrite(arrayOfElements, sizeof(int), l, f) != (size_t) l || fclose(f) != 0) {
+      perror(savePath);
+      return 1;
+    }
+  }
+  if (argsort || payloadBytes > 0)
+    return sortRecords(l, payloadBytes);
+  if (numQuantiles > 0)
+    return findQuantiles(l, quantiles, numQuantiles, seed);
+
   #ifdef DEBUG
     printf("initial array/vector: \n");
     printf("[ ");
@@ -71,15 +373,23 @@ int main(int argc, char *argv[]) {
     printf("]");
   #endif
 
-  list.last = l - 1;
-  list.first = 0;
-  list.a = &arrayOfElements[0]; //First element in the array, first in the memmory
-
-  /* Instantiate mutes/locks */
-  pthread_mutex_init(&thready, NULL);
+  /* keep a copy for quicksort to check the other engines against */
+  copy = NULL;
+  if (sort != quickSort) {
+    copy = malloc(l * sizeof(int));
+    if (copy == NULL) {
+      fprintf(stderr, "Could not allocate %ld elements\n", l);
+      return 1;
+    }
+    memcpy(copy, arrayOfElements, l * sizeof(int));
+    if (!reserveSpare(l)) {
+      fprintf(stderr, "Could not allocate %ld elements\n", l);
+      return 1;
+    }
+  }
 
   start_time = read_timer();
-  quickSort((void*) &list); /* Sort array */
+  sort(arrayOfElements, l); /* Sort array */
   end_time = read_timer();
   #ifdef DEBUG
     printf("\nSorted array: \n");
@@ -89,62 +399,816 @@ int main(int argc, char *argv[]) {
     }
     printf("]\n\n");
   #endif
+  for (i = 1; i < l; i++)
+    if (arrayOfElements[i-1] > arrayOfElements[i]) break;
+  if (i < l)
+    printf("The array is NOT sorted (index %d)\n", i);
   printf("The execution time is %g sec\n", end_time - start_time);
+  if (copy != NULL) {
+    check_time = read_timer();
+    quickSort(copy, l);
+    check_time = read_timer() - check_time;
+    if (memcmp(copy, arrayOfElements, l * sizeof(int)) != 0)
+      printf("The result does NOT match quicksort\n");
+    printf("Quicksort took %g sec\n", check_time);
+    free(copy);
+  }
+  free(arrayOfElements);
+  return 0;
 }
 
-void* quickSort(void *array) {
-  structArray lArray, rArray; /* Two structs for a the two splits*/
-  pthread_t ltid; /* New thread for sorting one split */
-  int pivot, i_pivot, first, last, right, left, temp, *a;
+/* swap a[i] and a[j], and perm[i] and perm[j] if there is a perm */
+static inline void swapElements(int *a, int *perm, int i, int j) {
+  int temp = a[i];
 
-  first = ((structArray *) array)->first; //First element
-  last = ((structArray *) array)->last; //First element
-  a = ((structArray *) array)->a; //Copy of Array.
+  a[i] = a[j];
+  a[j] = temp;
+  if (perm != NULL) {
+    temp = perm[i];
+    perm[i] = perm[j];
+    perm[j] = temp;
+  }
+}
+
+/* Insertion sort a[first..last], moving perm along; the range is small */
+void insertionSort(int *a, int *perm, int first, int last) {
+  int i, j, v, w = 0;
+
+  for (i = first + 1; i <= last; i++) {
+    v = a[i];
+    if (perm != NULL) w = perm[i];
+    for (j = i; j > first && a[j-1] > v; j--) {
+      a[j] = a[j-1];
+      if (perm != NULL) perm[j] = perm[j-1];
+    }
+    a[j] = v;
+    if (perm != NULL) perm[j] = w;
+  }
+}
+
+/* Restore the heap a[first..] of n elements below node i */
+void siftDown(int *a, int *perm, int first, int i, int n) {
+  int child;
 
-  /* Base case fo the reccursive */
-  if (first >= last) {
+  while ((child = 2*i + 1) < n) {
+    if (child + 1 < n && a[first + child] < a[first + child + 1]) child++;
+    if (a[first + child] <= a[first + i]) break;
+    swapElements(a, perm, first + i, first + child);
+    i = child;
+  }
+}
+
+/* Heapsort a[first..last]: the fallback when the pivots keep going wrong */
+void heapSort(int *a, int *perm, int first, int last) {
+  int i, n = last - first + 1;
+
+  for (i = n/2 - 1; i >= 0; i--)
+    siftDown(a, perm, first, i, n);
+  for (i = n - 1; i > 0; i--) {
+    swapElements(a, perm, first, first + i);
+    siftDown(a, perm, first, 0, i);
+  }
+}
+
+/* the position of the median of a[i], a[j] and a[k] */
+static inline int median3(int *a, int i, int j, int k) {
+  if (a[i] < a[j]) {
+    if (a[j] < a[k]) return j;
+    return (a[i] < a[k]) ? k : i;
+  }
+  if (a[i] < a[k]) return i;
+  return (a[j] < a[k]) ? k : j;
+}
+
+/* The position of the pivot for a[first..last]: the median of the
+first, middle and last elements, or for large ranges the median of
+three such medians (Tukey's ninther) */
+int choosePivot(int *a, int first, int last) {
+  int mid = first + (last - first)/2, step;
+
+  if (last - first + 1 < NINTHERSIZE)
+    return median3(a, first, mid, last);
+  step = (last - first + 1)/8;
+  return median3(a, median3(a, first, first + step, first + 2*step),
+                 median3(a, mid - step, mid, mid + step),
+                 median3(a, last - 2*step, last - step, last));
+}
+
+/* Partition a[first..last] three ways around a[p] (Dijkstra's Dutch
+flag), moving perm along. On return a[first..*lt-1] < pivot,
+a[*lt..*gt] == pivot and a[*gt+1..last] > pivot */
+void partitionDutch(int *a, int *perm, int first, int last, int p, int *lt, int *gt) {
+  int i = first, pivot = a[p];
+
+  *lt = first;
+  *gt = last;
+  while (i <= *gt) {
+    if (a[i] < pivot)
+      swapElements(a, perm, i++, (*lt)++);
+    else if (a[i] > pivot)
+      swapElements(a, perm, i, (*gt)--);
+    else
+      i++;
+  }
+}
+
+/* does x belong left of pivot: x < pivot, or x <= pivot with equalLeft */
+static inline bool goesLeft(int x, int pivot, bool equalLeft) {
+  return equalLeft ? x <= pivot : x < pivot;
+}
+
+/* Move the elements of a[first..last] that go left of pivot to the
+front and return where the others begin. Blocks of BLOCKSIZE elements
+at both ends are classified without branches into buffers of the
+offsets of misplaced elements, and then pairs of those are swapped;
+the last two blocks or so are finished by a branchless Lomuto loop.
+Only the swaps touch perm, so the classification reads keys alone */
+static inline int blockSplit(int *a, int *perm, int first, int last, int pivot, bool equalLeft) {
+  unsigned char offsetsL[BLOCKSIZE], offsetsR[BLOCKSIZE];
+  int numL = 0, numR = 0, startL = 0, startR = 0;
+  int l = first, r = last + 1; /* a[first..l-1] go left, a[r..last] go right */
+  int i, n, x, y;
+  bool left;
+
+  while (r - l > 2*BLOCKSIZE) {
+    if (numL == 0) {
+      startL = 0;
+      for (i = 0; i < BLOCKSIZE; i++) {
+        offsetsL[numL] = (unsigned char) i;
+        numL += !goesLeft(a[l + i], pivot, equalLeft);
+      }
+    }
+    if (numR == 0) {
+      startR = 0;
+      for (i = 0; i < BLOCKSIZE; i++) {
+        offsetsR[numR] = (unsigned char) (i + 1);
+        numR += goesLeft(a[r - i - 1], pivot, equalLeft);
+      }
+    }
+    n = (numL < numR) ? numL : numR;
+    for (i = 0; i < n; i++)
+      swapElements(a, perm, l + offsetsL[startL + i], r - offsetsR[startR + i]);
+    numL -= n;
+    numR -= n;
+    startL += n;
+    startR += n;
+    if (numL == 0) l += BLOCKSIZE;
+    if (numR == 0) r -= BLOCKSIZE;
+  }
+
+  /* the rest, including a block whose misplaced elements are left over */
+  for (i = l; i < r; i++) {
+    x = a[i];
+    left = goesLeft(x, pivot, equalLeft);
+    a[i] = a[l];
+    a[l] = x;
+    if (perm != NULL) {
+      y = perm[i];
+      perm[i] = perm[l];
+      perm[l] = y;
+    }
+    l += left;
+  }
+  return l;
+}
+
+/* Partition a[first..last] around a[p] with the block kernel, moving
+perm along. Usually a[first..*lt-1] < pivot, a[*lt] == a[*gt] is the
+pivot and a[*gt+1..last] >= pivot. But a range that starts after the
+first element follows one that is no larger than any of its elements,
+so if that one equals the pivot, so does everything not larger than
+it: then a[*lt..*gt] are the keys equal to the pivot and the rest are
+larger */
+void partitionBlock(int *a, int *perm, int first, int last, int p, int *lt, int *gt) {
+  int pivot = a[p], m;
+
+  swapElements(a, perm, first, p);
+  if (first > 0 && !(a[first-1] < pivot)) {
+    m = blockSplit(a, perm, first + 1, last, pivot, true);
+    *lt = first;
+    *gt = m - 1;
     return;
   }
+  m = blockSplit(a, perm, first + 1, last, pivot, false);
+  swapElements(a, perm, first, m - 1);
+  *lt = *gt = m - 1;
+}
+
+/* Sort a[first..last] in the calling thread, moving perm along.
+Recurses on the smaller side and loops on the larger one to keep the
+stack shallow; depth is the number of splits left before heapsort
+takes over */
+void sequentialSort(int *a, int *perm, int first, int last, int depth) {
+  int lt, gt;
+
+  while (last - first + 1 > INSERTIONCUTOFF) {
+    if (depth-- == 0) {
+      heapSort(a, perm, first, last);
+      return;
+    }
+    partition(a, perm, first, last, choosePivot(a, first, last), &lt, &gt);
+    if (lt - first < last - gt) {
+      sequentialSort(a, perm, first, lt - 1, depth);
+      first = gt + 1;
+    } else {
+      sequentialSort(a, perm, gt + 1, last, depth);
+      last = lt - 1;
+    }
+  }
+  insertionSort(a, perm, first, last);
+}
+
+/* Push a partition on the bottom of my deque, false if it is full */
+bool pushTask(int myid, structArray task) {
+  taskDeque *d = &deques[myid];
+  bool pushed = false;
+
+  pthread_mutex_lock(&d->lock);
+  if (d->bottom - d->top < DEQUESIZE) {
+    d->tasks[d->bottom % DEQUESIZE] = task;
+    d->bottom++;
+    pushed = true;
+  }
+  pthread_mutex_unlock(&d->lock);
+  return pushed;
+}
+
+/* Pop the newest partition from the bottom of my deque */
+bool popTask(int myid, structArray *task) {
+  taskDeque *d = &deques[myid];
+  bool popped = false;
+
+  pthread_mutex_lock(&d->lock);
+  if (d->bottom > d->top) {
+    d->bottom--;
+    *task = d->tasks[d->bottom % DEQUESIZE];
+    popped = true;
+  }
+  pthread_mutex_unlock(&d->lock);
+  return popped;
+}
+
+/* Steal the oldest partition from the top of another worker's deque */
+bool stealTask(int myid, structArray *task) {
+  taskDeque *d;
+  int i;
+
+  for (i = 1; i < numWorkers; i++) {
+    d = &deques[(myid + i) % numWorkers];
+    if (atomic_load_explicit(&d->bottom, memory_order_relaxed)
+        == atomic_load_explicit(&d->top, memory_order_relaxed))
+      continue; /* looks empty; a nonempty look is rechecked under the lock */
+    pthread_mutex_lock(&d->lock);
+    if (d->bottom > d->top) {
+      *task = d->tasks[d->top % DEQUESIZE];
+      d->top++;
+      pthread_mutex_unlock(&d->lock);
+      return true;
+    }
+    pthread_mutex_unlock(&d->lock);
+  }
+  return false;
+}
+
+/* Sort one partition: split it until it is below the cutoff, pushing
+the larger side for others to steal and keeping the smaller one */
+void runTask(int myid, structArray task) {
+  structArray other;
+  int lt, gt, *a = task.a, *perm = task.perm;
+
+  while (task.last - task.first + 1 > cutoff) {
+    if (task.depth-- == 0) {
+      heapSort(a, perm, task.first, task.last);
+      return;
+    }
+    partition(a, perm, task.first, task.last, choosePivot(a, task.first, task.last), &lt, &gt);
+    other.a = a;
+    other.perm = perm;
+    other.depth = task.depth;
+    if (lt - task.first < task.last - gt) {
+      other.first = gt + 1;
+      other.last = task.last;
+      task.last = lt - 1;
+    } else {
+      other.first = task.first;
+      other.last = lt - 1;
+      task.first = gt + 1;
+    }
+    atomic_fetch_add(&pendingTasks, 1);
+    if (!pushTask(myid, other)) {
+      /* deque is full, sort the other side here */
+      runTask(myid, other);
+      atomic_fetch_sub(&pendingTasks, 1);
+    }
+  }
+  sequentialSort(a, perm, task.first, task.last, task.depth);
+}
 
-  i_pivot = (first + last)/2;
-  pivot = arrayOfElements[i_pivot]; //Get pivot element from the global array
-  //quickSort
-  left = first;
-  right = last;
-  while (left <= right) {
-    if (pivot < a[left]) {
-      temp = arrayOfElements[left];
-      arrayOfElements[left] = a[right];
-      arrayOfElements[right] = temp;
-      if (right == i_pivot) {
-        i_pivot = left;
+/* Each worker sorts partitions from its own deque, steals when it is
+empty, and leaves once no partition is waiting or being sorted */
+void *Worker(void *arg) {
+  long myid = (long) arg;
+  structArray task;
+
+  while (atomic_load(&pendingTasks) > 0) {
+    if (popTask(myid, &task) || stealTask(myid, &task)) {
+      runTask(myid, task);
+      atomic_fetch_sub(&pendingTasks, 1);
+    } else {
+      sched_yield();
+    }
+  }
+  return NULL;
+}
+
+/* splits a range of n elements may take before heapsort: 2 log2 n */
+int depthLimit(int n) {
+  int depth;
+
+  for (depth = 0; n > 1; n /= 2)
+    depth += 2;
+  return depth;
+}
+
+/* Sort a[0..n-1] in the calling thread */
+void sequentialQuickSort(int *a, int n) {
+  sequentialSort(a, NULL, 0, n - 1, depthLimit(n));
+}
+
+/* Sort a[0..n-1] with the worker pool, making the same moves in
+perm[0..n-1] unless it is NULL; the calling thread is worker 0 */
+void quickSortWith(int *a, int *perm, int n) {
+  pthread_t workerid[MAXWORKERS];
+  structArray list;
+  long l;
+
+  for (l = 0; l < numWorkers; l++) {
+    pthread_mutex_init(&deques[l].lock, NULL);
+    deques[l].top = deques[l].bottom = 0;
+  }
+  list.a = a; //First element in the array, first in the memmory
+  list.perm = perm;
+  list.first = 0;
+  list.last = n - 1;
+  list.depth = depthLimit(n);
+  atomic_store(&pendingTasks, 1);
+  pushTask(0, list);
+
+  for (l = 1; l < numWorkers; l++)
+    pthread_create(&workerid[l], NULL, Worker, (void *) l);
+  Worker((void *) 0);
+  for (l = 1; l < numWorkers; l++)
+    pthread_join(workerid[l], NULL);
+  for (l = 0; l < numWorkers; l++)
+    pthread_mutex_destroy(&deques[l].lock);
+}
+
+/* Sort a[0..n-1] with the worker pool */
+void quickSort(int *a, int n) {
+  quickSortWith(a, NULL, n);
+}
+
+/* Sort a[0..n-1] and set perm[i] to the position the i-th smallest key
+had before */
+void argSort(int *a, int *perm, int n) {
+  int i;
+
+  for (i = 0; i < n; i++)
+    perm[i] = i;
+  quickSortWith(a, perm, n);
+}
+
+/* Each worker moves its share of the records to their sorted places */
+void *GatherWorker(void *arg) {
+  long myid = (long) arg;
+  long i, first = (long) gatherCount * myid / numWorkers;
+  long last = (long) gatherCount * (myid + 1) / numWorkers;
+
+  for (i = first; i < last; i++)
+    memcpy(gatherTo + i * recordBytes, gatherFrom + gatherPerm[i] * recordBytes, recordBytes);
+  return NULL;
+}
+
+/* to[i] = from[perm[i]] for n records, with the worker pool */
+void gatherRecords(const char *from, char *to, const int *perm, int n) {
+  pthread_t workerid[MAXWORKERS];
+  long l;
+
+  gatherFrom = from;
+  gatherTo = to;
+  gatherPerm = perm;
+  gatherCount = n;
+  for (l = 1; l < numWorkers; l++)
+    pthread_create(&workerid[l], NULL, GatherWorker, (void *) l);
+  GatherWorker((void *) 0);
+  for (l = 1; l < numWorkers; l++)
+    pthread_join(workerid[l], NULL);
+}
+
+/* the byte j of the payload of a record with this key */
+static inline char payloadByte(int key, int j) {
+  return (char) (key * 31 + j);
+}
+
+/* argsort, or with payloadBytes records of a key and a payload: sort a
+copy of the keys in arrayOfElements with a permutation, then move the
+records once. Checks that the keys are sorted, that the permutation
+maps them back to the original ones and that every record kept its
+payload. Returns the exit code */
+int sortRecords(int n, int payloadBytes) {
+  int *keys = malloc(n * sizeof(int)), *perm = malloc(n * sizeof(int));
+  char *seen = calloc(n, 1), *records = NULL, *sorted = NULL, *r;
+  double gather_time = 0;
+  int i, j, key, bad = -1;
+
+  recordBytes = sizeof(int) + payloadBytes;
+  if (payloadBytes > 0) {
+    records = malloc((size_t) n * recordBytes);
+    sorted = malloc((size_t) n * recordBytes);
+  }
+  if (keys == NULL || perm == NULL || seen == NULL || (payloadBytes > 0 && (records == NULL || sorted == NULL))) {
+    fprintf(stderr, "Could not allocate %d records\n", n);
+    return 1;
+  }
+  for (i = 0; i < n; i++) {
+    keys[i] = arrayOfElements[i];
+    if (payloadBytes == 0) continue;
+    r = records + i * recordBytes;
+    memcpy(r, &keys[i], sizeof(int));
+    for (j = 0; j < payloadBytes; j++)
+      r[sizeof(int) + j] = payloadByte(keys[i], j);
+  }
+
+  start_time = read_timer();
+  argSort(keys, perm, n);
+  end_time = read_timer();
+  if (payloadBytes > 0) {
+    gather_time = read_timer();
+    gatherRecords(records, sorted, perm, n);
+    gather_time = read_timer() - gather_time;
+  }
+
+  for (i = 0; i < n && bad < 0; i++) {
+    if ((i > 0 && keys[i-1] > keys[i]) || perm[i] < 0 || perm[i] >= n || seen[perm[i]]
+        || arrayOfElements[perm[i]] != keys[i])
+      bad = i;
+    else
+      seen[perm[i]] = 1;
+    if (payloadBytes == 0 || bad >= 0) continue;
+    r = sorted + i * recordBytes;
+    memcpy(&key, r, sizeof(int));
+    for (j = 0; j < payloadBytes && key == keys[i]; j++)
+      if (r[sizeof(int) + j] != payloadByte(key, j)) bad = i;
+    if (key != keys[i]) bad = i;
+  }
+  if (bad >= 0)
+    printf("The records are NOT sorted (index %d)\n", bad);
+  printf("The execution time is %g sec\n", end_time - start_time);
+  if (payloadBytes > 0)
+    printf("Moving the %d-byte records took %g sec\n", (int) recordBytes, gather_time);
+  free(keys);
+  free(perm);
+  free(seen);
+  free(records);
+  free(sorted);
+  free(arrayOfElements);
+  return bad >= 0 ? 1 : 0;
+}
+
+/* Sort the file at in into the file at out in memoryMB megabytes, with
+runs sorted by the chosen engine. Returns the exit code */
+int sortFile(const char *in, const char *out, const char *tmpdir, long memoryMB) {
+  extStats stats;
+
+  /* radix and merge allocate a second buffer as large as the run */
+  if (!externalSort(in, out, tmpdir, memoryMB * 1024 * 1024 / (long) sizeof(int), sort,
+                    sort == quickSort ? 0 : 1, read_timer, &stats))
+    return 1;
+  if (!stats.sorted)
+    printf("The output is NOT sorted\n");
+  if (!stats.sameKeys)
+    printf("The output does NOT hold the keys of the input\n");
+  printf("Sorted %lld keys in %d runs\n", stats.count, stats.runs);
+  printf("Making the runs took %g sec, merging them %g sec\n", stats.runSeconds, stats.mergeSeconds);
+  printf("The execution time is %g sec\n", stats.runSeconds + stats.mergeSeconds);
+  return (stats.sorted && stats.sameKeys) ? 0 : 1;
+}
+
+/* Each worker of the selection pool samples, then scans, its chunk of
+the keys; worker 0 places the brackets and finds the keys in them */
+void *SelectWorker(void *arg) {
+  long myid = (long) arg;
+  long first = (long) selectCount * myid / numWorkers, last = (long) selectCount * (myid + 1) / numWorkers;
+
+  quantileSample(&selection, selectKeys + first, last - first, first);
+  barrierWait(&barrier, myid);
+  if (myid == 0) quantilePlan(&selection);
+  barrierWait(&barrier, myid);
+  while (!selection.finished) {
+    quantileScan(&selection, myid, selectKeys + first, last - first);
+    barrierWait(&barrier, myid);
+    if (myid == 0) quantileFinish(&selection);
+    barrierWait(&barrier, myid);
+  }
+  return NULL;
+}
+
+/* Find the quantiles q[0..count-1] of arrayOfElements[0..n-1] with the
+worker pool and print them, then sort the keys with the chosen engine
+and check them against the sorted keys. Returns the exit code */
+int findQuantiles(int n, const double *q, int count, uint64_t seed) {
+  pthread_t workerid[MAXWORKERS];
+  double select_time, sort_time;
+  bool ok = true;
+  long l;
+  int j;
+
+  if (!barrierInit(&barrier, barrierKindUsed, numWorkers)
+      || !quantileInit(&selection, q, count, n, numWorkers, seed, partition)) {
+    fprintf(stderr, "Could not allocate the selection of %d elements\n", n);
+    exit(1);
+  }
+  selectKeys = arrayOfElements;
+  selectCount = n;
+  start_time = read_timer();
+  for (l = 1; l < numWorkers; l++)
+    pthread_create(&workerid[l], NULL, SelectWorker, (void *) l);
+  SelectWorker((void *) 0);
+  for (l = 1; l < numWorkers; l++)
+    pthread_join(workerid[l], NULL);
+  select_time = read_timer() - start_time;
+  barrierDestroy(&barrier);
+  if (selection.failed) {
+    fprintf(stderr, "Could not keep the keys inside the brackets\n");
+    quantileFree(&selection);
+    return 1;
+  }
+  for (j = 0; j < count; j++)
+    printf("The %g quantile is %d\n", q[j], selection.value[j]);
+  printf("The execution time is %g sec (%d %s)\n", select_time, selection.passes,
+         (selection.passes == 1) ? "pass" : "passes");
+
+  if (sort != quickSort) reserveSpare(n);
+  sort_time = read_timer();
+  sort(arrayOfElements, n);
+  sort_time = read_timer() - sort_time;
+  for (j = 0; j < count; j++)
+    if (arrayOfElements[selection.rank[j]] != selection.value[j]) {
+      printf("The %g quantile does NOT match the sorted keys (%d)\n", q[j],
+             arrayOfElements[selection.rank[j]]);
+      ok = false;
+    }
+  printf("Sorting took %g sec\n", sort_time);
+  quantileFree(&selection);
+  free(arrayOfElements);
+  return ok ? 0 : 1;
+}
+
+/* Each worker of the radix pool sorts its share of every pass */
+void *RadixWorker(void *arg) {
+  radixSortWorker(&radix, (long) arg);
+  return NULL;
+}
+
+/* Make spare hold n ints or more, touching its pages so that the sort
+that uses it does not pay for their faults; called before the timers
+start. Returns false without memory; the engines then allocate a buffer
+of their own */
+bool reserveSpare(long n) {
+  if (n <= spareInts) return true;
+  free(spare);
+  spare = malloc((n > 0 ? n : 1) * sizeof(int));
+  spareInts = (spare != NULL) ? n : 0;
+  if (spare == NULL) return false;
+  memset(spare, 0, n * sizeof(int));
+  return true;
+}
+
+/* Sort a[0..n-1] with the radix sort; the calling thread is worker 0.
+The second buffer is spare if it is large enough */
+void radixSort(int *a, int n) {
+  pthread_t workerid[MAXWORKERS];
+  long l;
+
+  if (!barrierInit(&barrier, barrierKindUsed, numWorkers)
+      || !radixInit(&radix, a, n, numWorkers, &barrier, (n <= spareInts) ? spare : NULL)) {
+    fprintf(stderr, "Could not allocate the radix sort of %d elements\n", n);
+    exit(1);
+  }
+  for (l = 1; l < numWorkers; l++)
+    pthread_create(&workerid[l], NULL, RadixWorker, (void *) l);
+  RadixWorker((void *) 0);
+  for (l = 1; l < numWorkers; l++)
+    pthread_join(workerid[l], NULL);
+  radixFree(&radix);
+  barrierDestroy(&barrier);
+}
+
+/* Each worker of the merge pool sorts its chunk and its share of every level */
+void *MergeWorker(void *arg) {
+  mergeSortWorker(&merger, (long) arg);
+  return NULL;
+}
+
+/* Sort a[0..n-1] with the merge sort; the calling thread is worker 0.
+The second buffer is spare if it is large enough */
+void mergeSort(int *a, int n) {
+  pthread_t workerid[MAXWORKERS];
+  long l;
+
+  if (!barrierInit(&barrier, barrierKindUsed, numWorkers)
+      || !mergeInit(&merger, a, n, numWorkers, &barrier, sequentialQuickSort,
+                    (n <= spareInts) ? spare : NULL)) {
+    fprintf(stderr, "Could not allocate the merge sort of %d elements\n", n);
+    exit(1);
+  }
+  for (l = 1; l < numWorkers; l++)
+    pthread_create(&workerid[l], NULL, MergeWorker, (void *) l);
+  MergeWorker((void *) 0);
+  for (l = 1; l < numWorkers; l++)
+    pthread_join(workerid[l], NULL);
+  mergeFree(&merger);
+  barrierDestroy(&barrier);
+}
+
+int compareDoubles(const void *a, const void *b) {
+  double x = *(const double *) a, y = *(const double *) b;
+  return (x > y) - (x < y);
+}
+
+/* Time one partition of n random 32-bit keys by every kernel, trials
+times each, and print the median and best times as CSV. Every result
+is checked; a kernel that gets one wrong is reported on stderr */
+void benchPartition(int n, int trials, uint64_t seed) {
+  int *keys = malloc(n * sizeof(int)), *a = malloc(n * sizeof(int));
+  double *times = malloc(trials * sizeof(double)), median;
+  int i, k, trial, lt, gt;
+  bool ok;
+
+  if (keys == NULL || a == NULL || times == NULL) {
+    fprintf(stderr, "Could not allocate %d elements\n", n);
+    exit(1);
+  }
+  for (i = 0; i < n; i++)
+    keys[i] = (int) (counterRng(seed, 0, (uint64_t) i) >> 32);
+
+  printf("kernel,elements,trials,median_ms,min_ms,melements_per_sec\n");
+  for (k = 0; k < KERNELS; k++) {
+    ok = true;
+    for (trial = 0; trial < trials; trial++) {
+      memcpy(a, keys, n * sizeof(int));
+      start_time = read_timer();
+      kernels[k](a, NULL, 0, n - 1, choosePivot(a, 0, n - 1), &lt, &gt);
+      times[trial] = read_timer() - start_time;
+      for (i = 0; i < n && ok; i++)
+        ok = (i < lt) ? a[i] < a[lt] : (i <= gt) ? a[i] == a[lt] : a[i] >= a[lt];
+    }
+    if (!ok)
+      fprintf(stderr, "kernel %s did not partition the keys\n", kernelNames[k]);
+    qsort(times, trials, sizeof(double), compareDoubles);
+    median = times[(trials - 1) / 2];
+    printf("%s,%d,%d,%.3f,%.3f,%.1f\n", kernelNames[k], n, trials,
+           1e3 * median, 1e3 * times[0], n / median / 1e6);
+  }
+  free(keys);
+  free(a);
+  free(times);
+}
+
+/* Parse a comma separated list of at most MAXSWEEP positive ints.
+Returns how many there were, 0 if one was bad */
+int parseList(const char *s, int *list) {
+  int n = 0;
+  char *end;
+
+  while (n < MAXSWEEP) {
+    list[n] = (int) strtol(s, &end, 10);
+    if (end == s || list[n] < 1) return 0;
+    n++;
+    if (*end != ',') break;
+    s = end + 1;
+  }
+  return n;
+}
+
+/* Parse a comma separated list of at most count of the names, storing
+their numbers in list. Returns how many there were, 0 if one was bad */
+int parseNames(const char *s, const char **names, int count, int *list) {
+  const char *end;
+  int n = 0, k;
+
+  for (; *s != '\0'; s = (*end == ',') ? end + 1 : end) {
+    end = strchr(s, ',');
+    if (end == NULL) end = s + strlen(s);
+    for (k = 0; k < count; k++)
+      if ((size_t) (end - s) == strlen(names[k]) && strncmp(s, names[k], end - s) == 0)
+        break;
+    if (k == count || n == count) {
+      fprintf(stderr, "unknown name %.*s\n", (int) (end - s), s);
+      return 0;
+    }
+    list[n++] = k;
+  }
+  return n;
+}
+
+/* Fill a[0..n-1] with keys of distribution dist */
+void fillKeys(int *a, int n, int dist, uint64_t seed) {
+  uint64_t r;
+  int i, bits;
+
+  for (i = 0; i < n; i++) {
+    r = counterRng(seed, 0, (uint64_t) i);
+    switch (dist) {
+    case 0: a[i] = (int) (r >> 32); break;
+    case 1: a[i] = i; break;
+    case 2: a[i] = n - i; break;
+    case 3: a[i] = 42; break;
+    case 4: a[i] = (int) (r % 1000); break;
+    case 5: a[i] = (i < n/2) ? i : n - i; break;
+    default:
+      bits = 1 + (int) (((r >> 32) * 30) >> 32); /* 1..30, each as likely */
+      a[i] = (1 << (bits - 1)) | (int) ((r & 0x3fffffff) >> (31 - bits));
+    }
+  }
+}
+
+int compareInts(const void *a, const void *b) {
+  int x = *(const int *) a, y = *(const int *) b;
+  return (x > y) - (x < y);
+}
+
+/* Time every engine on every distribution, size and worker count, with
+the qsort of the C library as the baseline and the reference result.
+Prints CSV and returns the exit code */
+int benchSort(const int *sizes, int numSizes, const int *workers, int numCounts,
+              const int *dists, int numDists, const int *sorts, int numSorts,
+              int trials, uint64_t seed) {
+  int i, d, e, c, trial, n, maxSize = 0;
+  int *input, *reference, *a;
+  double *times = malloc(trials * sizeof(double)), median, baseline;
+  bool ok, mismatch = false;
+
+  for (i = 0; i < numSizes; i++)
+    if (maxSize < sizes[i]) maxSize = sizes[i];
+  input = malloc((size_t) maxSize * sizeof(int));
+  reference = malloc((size_t) maxSize * sizeof(int));
+  a = malloc((size_t) maxSize * sizeof(int));
+  if (times == NULL || input == NULL || reference == NULL || a == NULL) {
+    fprintf(stderr, "Could not allocate %d elements\n", maxSize);
+    return 1;
+  }
+
+  printf("engine,kernel,distribution,size,workers,trials,median_ms,min_ms,melements_per_sec,speedup_vs_qsort\n");
+  for (d = 0; d < numDists; d++) {
+    for (i = 0; i < numSizes; i++) {
+      n = sizes[i];
+      fillKeys(input, n, dists[d], seed);
+
+      /* the baseline, which also gives the reference result */
+      for (trial = 0; trial < trials; trial++) {
+        memcpy(reference, input, n * sizeof(int));
+        start_time = read_timer();
+        qsort(reference, n, sizeof(int), compareInts);
+        times[trial] = read_timer() - start_time;
+      }
+      qsort(times, trials, sizeof(double), compareDoubles);
+      baseline = times[(trials - 1) / 2];
+      printf("qsort,-,%s,%d,1,%d,%.3f,%.3f,%.2f,1.00\n", distNames[dists[d]], n, trials,
+             1e3 * baseline, 1e3 * times[0], n / baseline / 1e6);
+      fflush(stdout);
+
+      for (e = 0; e < numSorts; e++) {
+        for (c = 0; c < numCounts; c++) {
+          numWorkers = (workers[c] < MAXWORKERS) ? workers[c] : MAXWORKERS;
+          if (sorts[e] != 0) reserveSpare(n);
+          ok = true;
+          for (trial = 0; trial < trials; trial++) {
+            memcpy(a, input, n * sizeof(int));
+            start_time = read_timer();
+            engines[sorts[e]](a, n);
+            times[trial] = read_timer() - start_time;
+            ok = ok && memcmp(a, reference, n * sizeof(int)) == 0;
+          }
+          if (!ok) {
+            fprintf(stderr, "%s with %d workers on %d %s keys: the result does NOT match qsort\n",
+                    engineNames[sorts[e]], numWorkers, n, distNames[dists[d]]);
+            mismatch = true;
+          }
+          qsort(times, trials, sizeof(double), compareDoubles);
+          median = times[(trials - 1) / 2];
+          printf("%s,%s,%s,%d,%d,%d,%.3f,%.3f,%.2f,%.2f\n", engineNames[sorts[e]],
+                 (sorts[e] == 0) ? kernelNames[partition == partitionDutch] : "-",
+                 distNames[dists[d]], n, numWorkers, trials, 1e3 * median, 1e3 * times[0],
+                 n / median / 1e6, baseline / median);
+          fflush(stdout);
+        }
       }
-      right--;
     }
-    else {
-      left++;
-    }
-  }
-
-  /*Place the pivot in its correct place (in the global array),
-  no locks because every thread works in their own splits */
-  temp = arrayOfElements[right];
-  arrayOfElements[right] = pivot;
-  arrayOfElements[i_pivot] = temp;
-
-  //Prepare the two sub-lists with the new struct
-  lArray.a = a;
-  lArray.first = first;
-  lArray.last = right-1;
-  rArray.a = a;
-  rArray.first = right + 1;
-  rArray.last = last;
-  //pthread_mutex_lock(&thready);
-  //printf("Hello, I am thread nr.%d\n", ++count);
-  //pthread_mutex_unlock(&thready);
-  pthread_create(&ltid, NULL, quickSort, (void *) &lArray);
-  //printf("quickSort\n");
-  quickSort((void *) &rArray);
-  pthread_join(ltid, NULL);
-  //printf("join\n");
+  }
+  free(times);
+  free(input);
+  free(reference);
+  free(a);
+  return mismatch ? 1 : 0;
 }
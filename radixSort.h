@@ -0,0 +1,281 @@
+/* parallel radix sort of ints
+
+   radixSortWorker sorts r->a[0..n-1] by the four 8-bit digits of its
+   keys (with the sign bit flipped, so that negative keys come first);
+   every worker of a pool calls it with its own id. A first pass counts
+   all four digits of the chunk of each worker, and digits that are the
+   same in every key are skipped.
+
+   The sort normally goes least significant digit first (LSD). In each
+   pass every worker counts the digit in its chunk, the counts of all
+   workers are turned into offsets after a barrier, and each worker
+   scatters its chunk to the other buffer through write-combining
+   buffers: a cache line of keys per bucket, copied out when full, so
+   that the 256 streams of the scatter write whole lines. The first
+   copy of a bucket holds only the keys up to the first line boundary,
+   so the ones after it land on whole, aligned lines.
+
+   Skewed keys, where one bucket of the most significant digit that
+   varies holds more than 1/RADIX_SKEW of them, go most significant
+   digit first (MSD) instead: one pass on that digit, after which each
+   bucket is sorted on the lower digits by itself, skipping the digits
+   that do not vary inside it, so that a bucket of a few heavy keys
+   costs little more than the count. Buckets larger than a worker's
+   share are sorted by all the workers together, one after the other,
+   and the others are claimed by single workers.
+
+*/
+#ifndef RADIXSORT_H
+#define RADIXSORT_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+#include "barrier.h"
+
+#define RADIX_DIGITS 4     /* 8-bit digits in an int */
+#define RADIX_BUCKETS 256  /* values of a digit */
+#define RADIX_LINE 16      /* ints in a write-combining buffer */
+#define RADIX_SKEW 2       /* MSD when a bucket holds more than 1/RADIX_SKEW of the keys */
+
+/* the counts and buffers of one worker */
+typedef struct {
+  _Alignas(BARRIER_LINE) long counts[RADIX_DIGITS][RADIX_BUCKETS]; /* of the chunk */
+  long passCounts[RADIX_BUCKETS];       /* of the digit of the current pass */
+  int lines[RADIX_BUCKETS][RADIX_LINE]; /* write-combining buffers */
+  long next[RADIX_BUCKETS];             /* where each buffer goes next */
+  int fill[RADIX_BUCKETS];              /* end of the keys in each buffer */
+  int lead[RADIX_BUCKETS];              /* where they begin: only the first copy is partial */
+} radixScratch;
+
+typedef struct {
+  int *a, *tmp;          /* the keys and a buffer as large */
+  long n;
+  int numWorkers;
+  barrierState *barrier; /* for numWorkers threads */
+  bool ownsTmp;          /* tmp was allocated by radixInit */
+  radixScratch *scratch; /* one per worker */
+  atomic_int nextBucket; /* MSD: next bucket to claim */
+} radixSorter;
+
+/* Set r up to sort a[0..n-1] with numWorkers workers waiting on
+   barrier, using tmp, of n ints or more, as the second buffer; with
+   tmp NULL, allocates one. Returns false without memory */
+static inline bool radixInit(radixSorter *r, int *a, long n, int numWorkers, barrierState *barrier,
+                             int *tmp) {
+  r->a = a;
+  r->n = n;
+  r->numWorkers = numWorkers;
+  r->barrier = barrier;
+  r->ownsTmp = tmp == NULL;
+  r->tmp = (tmp != NULL) ? tmp : malloc((n > 0 ? n : 1) * sizeof(int));
+  r->scratch = barrierAlloc(numWorkers * sizeof(radixScratch));
+  atomic_init(&r->nextBucket, 0);
+  return r->tmp != NULL && r->scratch != NULL;
+}
+
+static inline void radixFree(radixSorter *r) {
+  if (r->ownsTmp) free(r->tmp);
+  barrierRelease(r->scratch);
+  r->tmp = NULL;
+  r->scratch = NULL;
+}
+
+/* digit d of key x, with the sign bit flipped */
+static inline int radixDigit(int x, int d) {
+  return (int) ((((unsigned) x ^ 0x80000000u) >> (8*d)) & (RADIX_BUCKETS - 1));
+}
+
+/* wait for the other p - 1 participants, if any */
+static inline void radixSync(radixSorter *r, long myid, int p) {
+  if (p > 1) barrierWait(r->barrier, myid);
+}
+
+/* the worker whose scratch holds the counts of participant v */
+static inline int radixSlot(long myid, int p, int v) {
+  return (p == 1) ? (int) myid : v;
+}
+
+/* count digits 0..digits-1 of keys[first..last-1] into s */
+static inline void radixCount(radixScratch *s, const int *keys, long first, long last, int digits) {
+  unsigned x;
+  long i;
+  int d;
+
+  memset(s->counts, 0, sizeof(s->counts));
+  for (i = first; i < last; i++) {
+    x = (unsigned) keys[i] ^ 0x80000000u;
+    for (d = 0; d < digits; d++)
+      s->counts[d][(x >> (8*d)) & (RADIX_BUCKETS - 1)]++;
+  }
+}
+
+/* Scatter src[first..last-1] by digit d to dst, bucket b starting at
+   offsets[b], through the write-combining buffers of s */
+static inline void radixScatter(radixScratch *s, const int *src, int *dst, long first, long last,
+                                int d, const long *offsets) {
+  long i;
+  int b;
+
+  for (b = 0; b < RADIX_BUCKETS; b++) {
+    /* start the buffer as far into a line as the bucket is */
+    s->next[b] = offsets[b];
+    s->lead[b] = s->fill[b] = (int) (((uintptr_t) (dst + offsets[b]) / sizeof(int)) % RADIX_LINE);
+  }
+  for (i = first; i < last; i++) {
+    b = radixDigit(src[i], d);
+    s->lines[b][s->fill[b]++] = src[i];
+    if (s->fill[b] == RADIX_LINE) {
+      memcpy(dst + s->next[b], s->lines[b] + s->lead[b], (RADIX_LINE - s->lead[b]) * sizeof(int));
+      s->next[b] += RADIX_LINE - s->lead[b];
+      s->lead[b] = s->fill[b] = 0;
+    }
+  }
+  for (b = 0; b < RADIX_BUCKETS; b++)
+    memcpy(dst + s->next[b], s->lines[b] + s->lead[b], (s->fill[b] - s->lead[b]) * sizeof(int));
+}
+
+/* the bucket totals of digit d over all p participants */
+static inline void radixTotals(radixSorter *r, long myid, int p, int d, long *total) {
+  int b, v;
+
+  for (b = 0; b < RADIX_BUCKETS; b++)
+    total[b] = 0;
+  for (v = 0; v < p; v++)
+    for (b = 0; b < RADIX_BUCKETS; b++)
+      total[b] += r->scratch[radixSlot(myid, p, v)].counts[d][b];
+}
+
+/* does some key of n differ from the others in a digit with these totals */
+static inline bool radixVaries(const long *total, long n) {
+  int b;
+
+  for (b = 0; b < RADIX_BUCKETS; b++)
+    if (total[b] == n) return false;
+  return n > 1;
+}
+
+/* Where the keys of participant w go in one pass: the keys of all
+   smaller buckets, then those of bucket b from participants before w */
+static inline void radixOffsets(radixSorter *r, long myid, int p, int w, const long *total,
+                                bool pass, int d, long *offsets) {
+  long base = 0;
+  int b, v;
+  const radixScratch *s;
+
+  for (b = 0; b < RADIX_BUCKETS; b++) {
+    offsets[b] = base;
+    for (v = 0; v < w; v++) {
+      s = &r->scratch[radixSlot(myid, p, v)];
+      offsets[b] += pass ? s->passCounts[b] : s->counts[d][b];
+    }
+    base += total[b];
+  }
+}
+
+/* Sort keys[0..n-1] LSD on digits 0..digits-1, with other[0..n-1] as
+   the second buffer; the result ends up in other if toOther, in keys
+   otherwise. With p > 1 all the workers call this together and each
+   does its chunk; with p == 1 worker myid does it alone. If counted,
+   the chunks have already been counted into the scratch of each
+   participant */
+static inline void radixLsd(radixSorter *r, long myid, int p, int *keys, int *other, long n,
+                            int digits, bool toOther, bool counted) {
+  radixScratch *me = &r->scratch[myid];
+  int w = (p == 1) ? 0 : (int) myid, d, b;
+  long first = n * w / p, last = n * (w + 1) / p, i;
+  long total[RADIX_DIGITS][RADIX_BUCKETS], offsets[RADIX_BUCKETS];
+  bool varies[RADIX_DIGITS], fresh = true;
+  int *src = keys, *dst = other, *t;
+
+  if (!counted) {
+    radixCount(me, keys, first, last, digits);
+    radixSync(r, myid, p);
+  }
+  for (d = 0; d < digits; d++) {
+    radixTotals(r, myid, p, d, total[d]);
+    varies[d] = radixVaries(total[d], n);
+  }
+
+  for (d = 0; d < digits; d++) {
+    if (!varies[d]) continue;
+    if (fresh) {
+      /* the chunks have not moved since they were counted */
+      for (b = 0; b < RADIX_BUCKETS; b++)
+        me->passCounts[b] = me->counts[d][b];
+      fresh = false;
+    } else {
+      for (b = 0; b < RADIX_BUCKETS; b++)
+        me->passCounts[b] = 0;
+      for (i = first; i < last; i++)
+        me->passCounts[radixDigit(src[i], d)]++;
+    }
+    radixSync(r, myid, p);
+    radixOffsets(r, myid, p, w, total[d], true, d, offsets);
+    radixScatter(me, src, dst, first, last, d, offsets);
+    radixSync(r, myid, p);
+    t = src;
+    src = dst;
+    dst = t;
+  }
+
+  /* leave the keys where the caller wants them */
+  if (src != (toOther ? other : keys)) {
+    memcpy((toOther ? other : keys) + first, src + first, (last - first) * sizeof(int));
+    radixSync(r, myid, p);
+  }
+}
+
+/* Sort r->a; every worker of the pool calls this with its own id */
+static inline void radixSortWorker(radixSorter *r, long myid) {
+  int p = r->numWorkers, b, top, claimed;
+  long n = r->n, first = n * myid / p, last = n * (myid + 1) / p, largest;
+  long total[RADIX_BUCKETS], offsets[RADIX_BUCKETS], start[RADIX_BUCKETS + 1];
+  bool msd;
+
+  if (myid == 0) atomic_store(&r->nextBucket, 0);
+  radixCount(&r->scratch[myid], r->a, first, last, RADIX_DIGITS);
+  radixSync(r, myid, p);
+
+  /* the most significant digit that varies, and its largest bucket */
+  for (top = RADIX_DIGITS - 1; top >= 0; top--) {
+    radixTotals(r, myid, p, top, total);
+    if (radixVaries(total, n)) break;
+  }
+  if (top < 0) return; /* every key is the same */
+  largest = 0;
+  for (b = 0; b < RADIX_BUCKETS; b++)
+    if (largest < total[b]) largest = total[b];
+  msd = largest > n / RADIX_SKEW;
+  if (!msd) {
+    radixLsd(r, myid, p, r->a, r->tmp, n, top + 1, false, true);
+    return;
+  }
+
+  /* MSD: one pass on digit top to tmp */
+  radixOffsets(r, myid, p, (int) myid, total, false, top, offsets);
+  radixScatter(&r->scratch[myid], r->a, r->tmp, first, last, top, offsets);
+  radixSync(r, myid, p);
+  start[0] = 0;
+  for (b = 0; b < RADIX_BUCKETS; b++)
+    start[b + 1] = start[b] + total[b];
+
+  /* then the buckets on the lower digits, back to a: the large ones by
+     everybody, the rest by whoever claims them */
+  for (b = 0; b < RADIX_BUCKETS; b++)
+    if (total[b] > n / p && p > 1)
+      radixLsd(r, myid, p, r->tmp + start[b], r->a + start[b], total[b], top, true, false);
+  while ((claimed = atomic_fetch_add(&r->nextBucket, 1)) < RADIX_BUCKETS) {
+    if (total[claimed] > n / p && p > 1) continue;
+    if (top == 0 || total[claimed] < 2)
+      memcpy(r->a + start[claimed], r->tmp + start[claimed], total[claimed] * sizeof(int));
+    else
+      radixLsd(r, myid, 1, r->tmp + start[claimed], r->a + start[claimed], total[claimed],
+               top, true, false);
+  }
+  radixSync(r, myid, p);
+}
+
+#endif /* RADIXSORT_H */
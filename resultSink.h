@@ -0,0 +1,150 @@
+/* where workers publish their partial sum, min and max
+
+   Every worker calls sinkPublish once with its partial results; the
+   positions are linear indexes (row * cols + column). Ties between equal
+   values always go to the smallest index, so the result does not depend
+   on the order in which workers finish.
+
+     SINK_LOCKFREE  the sum is an atomic fetch-and-add; the min and the
+                    max are each one 64-bit word holding the value in the
+                    high half and the index in the low half, ordered so
+                    that a single compare-and-swap loop keeps the best
+                    pair; needs at most 2^32 elements
+     SINK_LOCKED    the same results kept under three mutexes
+
+*/
+#ifndef RESULTSINK_H
+#define RESULTSINK_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <limits.h>
+
+#define SINK_LOCKFREE 0
+#define SINK_LOCKED 1
+#define SINK_LINE 64              /* bytes in a cache line */
+#define SINK_MAXELEMENTS (1ULL << 32) /* most elements SINK_LOCKFREE can index */
+
+typedef struct {
+  int kind;
+  /* SINK_LOCKFREE, each word on its own line */
+  _Alignas(SINK_LINE) atomic_llong sum;
+  _Alignas(SINK_LINE) atomic_ullong max; /* larger is better */
+  _Alignas(SINK_LINE) atomic_ullong min; /* smaller is better */
+  /* SINK_LOCKED */
+  _Alignas(SINK_LINE) pthread_mutex_t sumLock, maxLock, minLock;
+  long long lockedSum;
+  int maxValue, minValue;
+  uint64_t maxIndex, minIndex;
+} resultSink;
+
+/* value in the high half so that unsigned order follows int order */
+static inline uint64_t sinkPackMin(int value, uint64_t index) {
+  return (uint64_t) ((uint32_t) value ^ 0x80000000u) << 32 | index;
+}
+
+/* for the max the index is complemented, so smaller indexes compare larger */
+static inline uint64_t sinkPackMax(int value, uint64_t index) {
+  return (uint64_t) ((uint32_t) value ^ 0x80000000u) << 32 | (0xFFFFFFFFu - index);
+}
+
+static inline int sinkValue(uint64_t packed) {
+  return (int) ((uint32_t) (packed >> 32) ^ 0x80000000u);
+}
+
+/* Set up an empty sink of the given kind for a matrix of elements
+   elements. Falls back to SINK_LOCKED, and returns false, when there
+   are too many elements to pack */
+static inline bool sinkInit(resultSink *s, int kind, uint64_t elements) {
+  bool ok = true;
+
+  if (kind == SINK_LOCKFREE && elements > SINK_MAXELEMENTS) {
+    kind = SINK_LOCKED;
+    ok = false;
+  }
+  s->kind = kind;
+  atomic_init(&s->sum, 0);
+  atomic_init(&s->max, 0);
+  atomic_init(&s->min, UINT64_MAX);
+  pthread_mutex_init(&s->sumLock, NULL);
+  pthread_mutex_init(&s->maxLock, NULL);
+  pthread_mutex_init(&s->minLock, NULL);
+  s->lockedSum = 0;
+  s->maxValue = INT_MIN;
+  s->minValue = INT_MAX;
+  s->maxIndex = s->minIndex = UINT64_MAX; /* loses every tie */
+  return ok;
+}
+
+static inline void sinkDestroy(resultSink *s) {
+  pthread_mutex_destroy(&s->sumLock);
+  pthread_mutex_destroy(&s->maxLock);
+  pthread_mutex_destroy(&s->minLock);
+}
+
+/* add one worker's partial results */
+static inline void sinkPublish(resultSink *s, long long sum,
+                               int maxValue, uint64_t maxIndex,
+                               int minValue, uint64_t minIndex) {
+  uint64_t cur, mine;
+
+  if (s->kind == SINK_LOCKFREE) {
+    atomic_fetch_add_explicit(&s->sum, sum, memory_order_relaxed);
+    mine = sinkPackMax(maxValue, maxIndex);
+    cur = atomic_load_explicit(&s->max, memory_order_relaxed);
+    while (mine > cur && !atomic_compare_exchange_weak_explicit(&s->max, &cur, mine,
+                                                                memory_order_relaxed, memory_order_relaxed))
+      ;
+    mine = sinkPackMin(minValue, minIndex);
+    cur = atomic_load_explicit(&s->min, memory_order_relaxed);
+    while (mine < cur && !atomic_compare_exchange_weak_explicit(&s->min, &cur, mine,
+                                                                memory_order_relaxed, memory_order_relaxed))
+      ;
+    return;
+  }
+
+  pthread_mutex_lock(&s->sumLock);
+  s->lockedSum += sum;
+  pthread_mutex_unlock(&s->sumLock);
+
+  pthread_mutex_lock(&s->maxLock);
+  if (maxValue > s->maxValue || (maxValue == s->maxValue && maxIndex < s->maxIndex)) {
+    s->maxValue = maxValue;
+    s->maxIndex = maxIndex;
+  }
+  pthread_mutex_unlock(&s->maxLock);
+
+  pthread_mutex_lock(&s->minLock);
+  if (minValue < s->minValue || (minValue == s->minValue && minIndex < s->minIndex)) {
+    s->minValue = minValue;
+    s->minIndex = minIndex;
+  }
+  pthread_mutex_unlock(&s->minLock);
+}
+
+/* the totals, once every worker has published */
+static inline void sinkRead(resultSink *s, long long *sum,
+                            int *maxValue, uint64_t *maxIndex,
+                            int *minValue, uint64_t *minIndex) {
+  uint64_t max, min;
+
+  if (s->kind == SINK_LOCKFREE) {
+    max = atomic_load(&s->max);
+    min = atomic_load(&s->min);
+    *sum = atomic_load(&s->sum);
+    *maxValue = sinkValue(max);
+    *maxIndex = 0xFFFFFFFFu - (max & 0xFFFFFFFFu);
+    *minValue = sinkValue(min);
+    *minIndex = min & 0xFFFFFFFFu;
+    return;
+  }
+  *sum = s->lockedSum;
+  *maxValue = s->maxValue;
+  *maxIndex = s->maxIndex;
+  *minValue = s->minValue;
+  *minIndex = s->minIndex;
+}
+
+#endif /* RESULTSINK_H */
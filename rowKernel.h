@@ -0,0 +1,195 @@
+/* fused row reduction kernel
+
+   rowReduce(row, n, &stats) computes the sum, the minimum and the maximum
+   of row[0..n-1] in one pass, together with the column of the first
+   occurrence of the minimum and of the maximum. The sum is kept in 64
+   bits so that long rows of large values do not overflow.
+
+   rowKernelInit() picks the widest implementation the CPU supports
+   (AVX-512, AVX2 or scalar) and must be called once before any thread
+   uses rowReduce. Passing a name ("avx512", "avx2" or "scalar") forces
+   that implementation when it is available, NULL picks the best one.
+
+*/
+#ifndef ROWKERNEL_H
+#define ROWKERNEL_H
+
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define ROWKERNEL_X86
+#include <immintrin.h>
+#endif
+
+typedef struct {
+  long long sum;
+  int maxValue, maxj; /* largest value and its first column */
+  int minValue, minj; /* smallest value and its first column */
+} rowStats;
+
+typedef void (*rowKernel)(const int *, int, rowStats *);
+
+/* plain loop, also used for the tails of the vector versions */
+static void rowReduceScalar(const int *row, int n, rowStats *s) {
+  long long sum = 0;
+  int j, maxValue = row[0], maxj = 0, minValue = row[0], minj = 0;
+
+  for (j = 0; j < n; j++) {
+    sum += row[j];
+    if (maxValue < row[j]) {
+      maxValue = row[j];
+      maxj = j;
+    }
+    if (minValue > row[j]) {
+      minValue = row[j];
+      minj = j;
+    }
+  }
+  s->sum = sum;
+  s->maxValue = maxValue;
+  s->maxj = maxj;
+  s->minValue = minValue;
+  s->minj = minj;
+}
+
+/* fold the elements from column j on into a partial result */
+static void rowReduceTail(const int *row, int j, int n, rowStats *s) {
+  for (; j < n; j++) {
+    s->sum += row[j];
+    if (s->maxValue < row[j]) {
+      s->maxValue = row[j];
+      s->maxj = j;
+    }
+    if (s->minValue > row[j]) {
+      s->minValue = row[j];
+      s->minj = j;
+    }
+  }
+}
+
+#ifdef ROWKERNEL_X86
+
+/* Every lane keeps its own running min and max and the column where it
+   was first seen (lanes only move on a strict improvement). The lanes
+   are then combined, taking the smallest column among equal values */
+__attribute__((target("avx2")))
+static void rowReduceAvx2(const int *row, int n, rowStats *s) {
+  __m256i v, idx, step, vmax, vmin, maxIdx, minIdx, gt, lt, sumLo, sumHi;
+  int maxs[8], mins[8], maxIdxs[8], minIdxs[8];
+  long long sums[4];
+  int j, k;
+
+  if (n < 8) {
+    rowReduceScalar(row, n, s);
+    return;
+  }
+  idx = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  step = _mm256_set1_epi32(8);
+  v = _mm256_loadu_si256((const __m256i *) row);
+  vmax = vmin = v;
+  maxIdx = minIdx = idx;
+  sumLo = _mm256_cvtepi32_epi64(_mm256_castsi256_si128(v));
+  sumHi = _mm256_cvtepi32_epi64(_mm256_extracti128_si256(v, 1));
+  for (j = 8; j + 8 <= n; j += 8) {
+    idx = _mm256_add_epi32(idx, step);
+    v = _mm256_loadu_si256((const __m256i *) (row + j));
+    gt = _mm256_cmpgt_epi32(v, vmax);
+    lt = _mm256_cmpgt_epi32(vmin, v);
+    vmax = _mm256_max_epi32(vmax, v);
+    vmin = _mm256_min_epi32(vmin, v);
+    maxIdx = _mm256_blendv_epi8(maxIdx, idx, gt);
+    minIdx = _mm256_blendv_epi8(minIdx, idx, lt);
+    sumLo = _mm256_add_epi64(sumLo, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(v)));
+    sumHi = _mm256_add_epi64(sumHi, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(v, 1)));
+  }
+
+  _mm256_storeu_si256((__m256i *) maxs, vmax);
+  _mm256_storeu_si256((__m256i *) mins, vmin);
+  _mm256_storeu_si256((__m256i *) maxIdxs, maxIdx);
+  _mm256_storeu_si256((__m256i *) minIdxs, minIdx);
+  _mm256_storeu_si256((__m256i *) sums, _mm256_add_epi64(sumLo, sumHi));
+  s->sum = sums[0] + sums[1] + sums[2] + sums[3];
+  s->maxValue = maxs[0];
+  s->maxj = maxIdxs[0];
+  s->minValue = mins[0];
+  s->minj = minIdxs[0];
+  for (k = 1; k < 8; k++) {
+    if (maxs[k] > s->maxValue || (maxs[k] == s->maxValue && maxIdxs[k] < s->maxj)) {
+      s->maxValue = maxs[k];
+      s->maxj = maxIdxs[k];
+    }
+    if (mins[k] < s->minValue || (mins[k] == s->minValue && minIdxs[k] < s->minj)) {
+      s->minValue = mins[k];
+      s->minj = minIdxs[k];
+    }
+  }
+  rowReduceTail(row, j, n, s);
+}
+
+/* same scheme as the AVX2 kernel with 16 lanes and mask registers */
+__attribute__((target("avx512f")))
+static void rowReduceAvx512(const int *row, int n, rowStats *s) {
+  __m512i v, idx, step, vmax, vmin, maxIdx, minIdx, sumLo, sumHi;
+  __mmask16 gt, lt;
+  int j;
+
+  if (n < 16) {
+    rowReduceAvx2(row, n, s);
+    return;
+  }
+  idx = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+  step = _mm512_set1_epi32(16);
+  v = _mm512_loadu_si512((const void *) row);
+  vmax = vmin = v;
+  maxIdx = minIdx = idx;
+  sumLo = _mm512_cvtepi32_epi64(_mm512_castsi512_si256(v));
+  sumHi = _mm512_cvtepi32_epi64(_mm512_extracti64x4_epi64(v, 1));
+  for (j = 16; j + 16 <= n; j += 16) {
+    idx = _mm512_add_epi32(idx, step);
+    v = _mm512_loadu_si512((const void *) (row + j));
+    gt = _mm512_cmpgt_epi32_mask(v, vmax);
+    lt = _mm512_cmplt_epi32_mask(v, vmin);
+    vmax = _mm512_mask_mov_epi32(vmax, gt, v);
+    vmin = _mm512_mask_mov_epi32(vmin, lt, v);
+    maxIdx = _mm512_mask_mov_epi32(maxIdx, gt, idx);
+    minIdx = _mm512_mask_mov_epi32(minIdx, lt, idx);
+    sumLo = _mm512_add_epi64(sumLo, _mm512_cvtepi32_epi64(_mm512_castsi512_si256(v)));
+    sumHi = _mm512_add_epi64(sumHi, _mm512_cvtepi32_epi64(_mm512_extracti64x4_epi64(v, 1)));
+  }
+
+  s->sum = _mm512_reduce_add_epi64(_mm512_add_epi64(sumLo, sumHi));
+  s->maxValue = _mm512_reduce_max_epi32(vmax);
+  s->maxj = _mm512_mask_reduce_min_epi32(
+      _mm512_cmpeq_epi32_mask(vmax, _mm512_set1_epi32(s->maxValue)), maxIdx);
+  s->minValue = _mm512_reduce_min_epi32(vmin);
+  s->minj = _mm512_mask_reduce_min_epi32(
+      _mm512_cmpeq_epi32_mask(vmin, _mm512_set1_epi32(s->minValue)), minIdx);
+  rowReduceTail(row, j, n, s);
+}
+
+#endif /* ROWKERNEL_X86 */
+
+static rowKernel rowReduce = rowReduceScalar; /* the kernel in use */
+static const char *rowKernelName = "scalar";
+
+/* choose the kernel, see the top of this file */
+static void rowKernelInit(const char *prefer) {
+  rowReduce = rowReduceScalar;
+  rowKernelName = "scalar";
+  if (prefer != NULL && strcmp(prefer, "scalar") == 0)
+    return;
+#ifdef ROWKERNEL_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx2")
+      && (prefer == NULL || strcmp(prefer, "avx512") == 0)) {
+    rowReduce = rowReduceAvx512;
+    rowKernelName = "avx512";
+  } else if (__builtin_cpu_supports("avx2")
+             && (prefer == NULL || strcmp(prefer, "avx2") == 0 || strcmp(prefer, "avx512") == 0)) {
+    rowReduce = rowReduceAvx2;
+    rowKernelName = "avx2";
+  }
+#endif
+}
+
+#endif /* ROWKERNEL_H */
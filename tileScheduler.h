@@ -0,0 +1,92 @@
+/* hands out the rectangular tiles of a rows x cols matrix to workers
+
+   tileSchedulerInit picks a tile shape from the size of the matrix, the
+   number of workers and the cache size: a tile should fit in half of
+   the L2 cache, and there should be at least TILES_PER_WORKER tiles per
+   worker so that the last ones even out the load. Tiles are as wide as
+   the matrix when a whole row fits, so that they stream contiguous
+   memory. When rows are long, a tile is TILE_ROWS rows (or all of them,
+   if there are fewer) by a block of columns a whole number of cache
+   lines wide. So tall-skinny, short-wide and square matrices all keep
+   every worker busy, even with fewer rows than workers.
+
+   tileNext claims the next tile, in row-major order of tiles, with one
+   atomic increment.
+
+*/
+#ifndef TILESCHEDULER_H
+#define TILESCHEDULER_H
+
+#include <stdbool.h>
+#include <stdatomic.h>
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+#define TILES_PER_WORKER 8          /* fewest tiles per worker */
+#define TILE_MINBYTES 4096          /* smallest tile worth a claim */
+#define TILE_DEFAULTL2 (1024*1024)  /* L2 size when it cannot be found */
+#define TILE_LINEINTS 16            /* ints in a cache line */
+#define TILE_ROWS 8                 /* rows of a tile cut from long rows */
+
+typedef struct {
+  int rows, cols;
+  int tileRows, tileCols;    /* shape of a tile; those at the edges may be smaller */
+  int tilesDown, tilesAcross;
+  int numTiles;
+  atomic_int next;           /* next tile to hand out */
+} tileScheduler;
+
+/* bytes of L2 cache per core */
+static inline long tileCacheBytes(void) {
+  long bytes = 0;
+#if defined(__linux__) && defined(_SC_LEVEL2_CACHE_SIZE)
+  bytes = sysconf(_SC_LEVEL2_CACHE_SIZE);
+#endif
+  return bytes > 0 ? bytes : TILE_DEFAULTL2;
+}
+
+/* Choose the tiles of a rows x cols matrix of ints for numWorkers workers */
+static inline void tileSchedulerInit(tileScheduler *t, int rows, int cols, int numWorkers) {
+  double total = (double) rows * cols * sizeof(int);
+  double target = tileCacheBytes() / 2;
+  double rowBytes = (double) cols * sizeof(int);
+
+  if (target > total / (TILES_PER_WORKER * numWorkers))
+    target = total / (TILES_PER_WORKER * numWorkers);
+  if (target < TILE_MINBYTES) target = TILE_MINBYTES;
+
+  t->rows = rows;
+  t->cols = cols;
+  if (rowBytes <= target) {
+    /* whole rows */
+    t->tileCols = cols;
+    t->tileRows = (int) (target / rowBytes);
+    if (t->tileRows > rows) t->tileRows = rows;
+  } else {
+    /* a block of whole cache lines from each of a few rows */
+    t->tileRows = (rows < TILE_ROWS) ? rows : TILE_ROWS;
+    t->tileCols = (int) (target / t->tileRows / sizeof(int)) / TILE_LINEINTS * TILE_LINEINTS;
+    if (t->tileCols < TILE_LINEINTS) t->tileCols = TILE_LINEINTS;
+    if (t->tileCols > cols) t->tileCols = cols;
+  }
+  t->tilesDown = (rows + t->tileRows - 1) / t->tileRows;
+  t->tilesAcross = (cols + t->tileCols - 1) / t->tileCols;
+  t->numTiles = t->tilesDown * t->tilesAcross;
+  atomic_init(&t->next, 0);
+}
+
+/* Claim the next tile: rows *r0..*r1 and columns *c0..*c1. Returns
+   false when every tile has been handed out */
+static inline bool tileNext(tileScheduler *t, int *r0, int *r1, int *c0, int *c1) {
+  int k = atomic_fetch_add_explicit(&t->next, 1, memory_order_relaxed);
+
+  if (k >= t->numTiles) return false;
+  *r0 = k / t->tilesAcross * t->tileRows;
+  *c0 = k % t->tilesAcross * t->tileCols;
+  *r1 = (*r0 + t->tileRows < t->rows) ? *r0 + t->tileRows - 1 : t->rows - 1;
+  *c1 = (*c0 + t->tileCols < t->cols) ? *c0 + t->tileCols - 1 : t->cols - 1;
+  return true;
+}
+
+#endif /* TILESCHEDULER_H */
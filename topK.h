@@ -0,0 +1,129 @@
+/* the k largest or k smallest elements of a matrix, with positions
+
+   A topKHeap is a bounded binary heap whose root is the worst of the
+   entries kept, so an element that does not beat the root is turned
+   away with one comparison. Elements are ordered by value and then by
+   position: of two equal values the one in the earlier row (or the
+   earlier column of the same row) is better. The result therefore does
+   not depend on how the matrix was split between workers.
+
+   topKRow takes the best value of the row as well (the row max or min
+   that rowReduce has just computed), and skips the whole row when even
+   that cannot get in, so once the heap has filled up nearly every row
+   costs no more than its reduction. Rows must be offered in increasing
+   order for the skip to be exact.
+
+*/
+#ifndef TOPK_H
+#define TOPK_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+
+typedef struct {
+  int value, row, col;
+} topKEntry;
+
+typedef struct {
+  int k, n;       /* capacity and number of entries kept */
+  bool largest;   /* keep the largest rather than the smallest */
+  topKEntry *e;   /* the heap, e[0] the worst entry kept */
+} topKHeap;
+
+/* Set up an empty heap for the k largest (or smallest) elements.
+   Returns false if there is no memory */
+static inline bool topKInit(topKHeap *h, int k, bool largest) {
+  h->k = k;
+  h->n = 0;
+  h->largest = largest;
+  h->e = malloc((k > 0 ? k : 1) * sizeof(topKEntry));
+  return h->e != NULL;
+}
+
+static inline void topKFree(topKHeap *h) {
+  free(h->e);
+  h->e = NULL;
+  h->n = 0;
+}
+
+/* is value at (row, col) better than entry e */
+static inline bool topKBetter(const topKHeap *h, int value, int row, int col, const topKEntry *e) {
+  if (value != e->value)
+    return h->largest ? value > e->value : value < e->value;
+  return row != e->row ? row < e->row : col < e->col;
+}
+
+/* move e[i] down until both children are better */
+static inline void topKSiftDown(topKHeap *h, int i) {
+  topKEntry x = h->e[i];
+  int child;
+
+  while ((child = 2*i + 1) < h->n) {
+    if (child + 1 < h->n
+        && topKBetter(h, h->e[child].value, h->e[child].row, h->e[child].col, &h->e[child + 1]))
+      child++;
+    if (!topKBetter(h, x.value, x.row, x.col, &h->e[child])) break;
+    h->e[i] = h->e[child];
+    i = child;
+  }
+  h->e[i] = x;
+}
+
+/* consider value at (row, col) */
+static inline void topKOffer(topKHeap *h, int value, int row, int col) {
+  topKEntry x;
+  int i, parent;
+
+  x.value = value;
+  x.row = row;
+  x.col = col;
+  if (h->n < h->k) {
+    /* not full: add it, moving worse parents down */
+    for (i = h->n++; i > 0; i = parent) {
+      parent = (i - 1) / 2;
+      if (!topKBetter(h, h->e[parent].value, h->e[parent].row, h->e[parent].col, &x))
+        break;
+      h->e[i] = h->e[parent];
+    }
+    h->e[i] = x;
+  } else if (h->k > 0 && topKBetter(h, value, row, col, &h->e[0])) {
+    h->e[0] = x;
+    topKSiftDown(h, 0);
+  }
+}
+
+/* consider the cols elements a of row i; best is the largest (or
+   smallest) of them */
+static inline void topKRow(topKHeap *h, const int *a, int cols, int i, int best) {
+  int j;
+
+  if (h->n == h->k && (h->k == 0 || !topKBetter(h, best, i, 0, &h->e[0]))) return;
+  for (j = 0; j < cols; j++)
+    if (h->n < h->k || topKBetter(h, a[j], i, j, &h->e[0]))
+      topKOffer(h, a[j], i, j);
+}
+
+/* add the entries of b to a */
+static inline void topKMerge(topKHeap *a, const topKHeap *b) {
+  int i;
+
+  for (i = 0; i < b->n; i++)
+    topKOffer(a, b->e[i].value, b->e[i].row, b->e[i].col);
+}
+
+/* sort the entries best first; the heap is not usable afterwards */
+static inline void topKSort(topKHeap *h) {
+  int n = h->n;
+  topKEntry t;
+
+  /* heapsort: the worst entry goes to the back each time */
+  while (h->n > 1) {
+    t = h->e[0];
+    h->e[0] = h->e[--h->n];
+    h->e[h->n] = t;
+    topKSiftDown(h, 0);
+  }
+  h->n = n;
+}
+
+#endif /* TOPK_H */
@@ -0,0 +1,159 @@
+/* optional per-worker counters for the reduction hot paths
+
+   Compiled in only with -DINSTRUMENT; otherwise every STATS_ macro
+   expands to nothing (STATS_WAIT to just its statement), so the
+   programs are the same as without it. Each worker brackets its
+   reduction with STATS_BEGIN and STATS_END and wraps its waits on
+   barriers and locks in STATS_WAIT; STATS_REPORT then prints, for
+   every worker, the rows and bytes it reduced, its busy time, its time
+   spent waiting, and its idle time until the slowest worker finished,
+   followed by the imbalance ratio (slowest over mean busy time) and
+   the bandwidth achieved.
+
+   Under Linux each worker also counts its user-space cycles and
+   last-level cache misses with perf_event_open, when the kernel lets
+   it (see /proc/sys/kernel/perf_event_paranoid).
+
+     STATS_BEGIN(id)              start counting for worker id
+     STATS_WAIT(id, statement)    run statement, counting it as waiting
+     STATS_ROWS(id, rows, bytes)  worker id reduced rows rows of bytes bytes
+     STATS_END(id)                stop counting for worker id
+     STATS_REPORT(n, seconds)     print the counters of workers 0..n-1,
+                                  seconds being the time of the reduction
+     STATS_ONLY(statement)        run statement only when counting, such
+                                  as a barrier before STATS_REPORT
+
+*/
+#ifndef WORKERSTATS_H
+#define WORKERSTATS_H
+
+#ifdef INSTRUMENT
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#define STATS_MAXWORKERS 64 /* most workers that are counted */
+#define STATS_LINE 64       /* bytes in a cache line */
+
+/* the counters of one worker, on cache lines of their own */
+typedef struct {
+  _Alignas(STATS_LINE) long long rows, bytes;
+  double begin, end;  /* when the worker started and stopped */
+  double wait;        /* seconds in STATS_WAIT */
+  long long cycles, llcMisses; /* -1 when not counted */
+  int cyclesFd, missesFd;
+} workerStats;
+
+static workerStats statsOf[STATS_MAXWORKERS];
+
+static inline double statsClock(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + 1.0e-9 * t.tv_nsec;
+}
+
+/* open a counting perf event for the calling thread, -1 if there is none */
+static inline int statsOpenCounter(unsigned long long config) {
+#ifdef __linux__
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = config;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+  (void) config;
+  return -1;
+#endif
+}
+
+/* read and close a counter opened by statsOpenCounter */
+static inline long long statsCloseCounter(int fd) {
+  long long value = -1;
+
+  if (fd < 0) return -1;
+#ifdef __linux__
+  if (read(fd, &value, sizeof(value)) != sizeof(value)) value = -1;
+  close(fd);
+#endif
+  return value;
+}
+
+static inline void statsBegin(long id) {
+  workerStats *s = &statsOf[id];
+
+  s->rows = s->bytes = 0;
+  s->wait = 0;
+#ifdef __linux__
+  s->cyclesFd = statsOpenCounter(PERF_COUNT_HW_CPU_CYCLES);
+  s->missesFd = statsOpenCounter(PERF_COUNT_HW_CACHE_MISSES);
+#else
+  s->cyclesFd = s->missesFd = -1;
+#endif
+  s->begin = statsClock();
+}
+
+static inline void statsEnd(long id) {
+  workerStats *s = &statsOf[id];
+
+  s->end = statsClock();
+  s->cycles = statsCloseCounter(s->cyclesFd);
+  s->llcMisses = statsCloseCounter(s->missesFd);
+}
+
+static inline void statsReport(int n, double seconds) {
+  int i;
+  long long rows = 0, bytes = 0;
+  double busy, maxBusy = 0, sumBusy = 0, lastEnd = 0;
+
+  if (n > STATS_MAXWORKERS) n = STATS_MAXWORKERS;
+  for (i = 0; i < n; i++)
+    if (statsOf[i].end > lastEnd) lastEnd = statsOf[i].end;
+  printf("worker       rows         MB    busy ms    wait ms    idle ms      cycles  LLC misses\n");
+  for (i = 0; i < n; i++) {
+    workerStats *s = &statsOf[i];
+    busy = s->end - s->begin - s->wait;
+    rows += s->rows;
+    bytes += s->bytes;
+    sumBusy += busy;
+    if (busy > maxBusy) maxBusy = busy;
+    printf("%6d %10lld %10.1f %10.3f %10.3f %10.3f", i, s->rows, s->bytes / 1e6,
+           1e3 * busy, 1e3 * s->wait, 1e3 * (lastEnd - s->end));
+    if (s->cycles >= 0) printf(" %11lld", s->cycles); else printf(" %11s", "n/a");
+    if (s->llcMisses >= 0) printf(" %11lld\n", s->llcMisses); else printf(" %11s\n", "n/a");
+  }
+  printf("%lld rows, imbalance ratio %.3f (slowest over mean busy time), %.3f GB/s\n",
+         rows, sumBusy > 0 ? maxBusy * n / sumBusy : 1.0,
+         seconds > 0 ? bytes / seconds / 1e9 : 0.0);
+}
+
+#define STATS_BEGIN(id) statsBegin(id)
+#define STATS_WAIT(id, ...) \
+  do { double statsT_ = statsClock(); __VA_ARGS__; statsOf[id].wait += statsClock() - statsT_; } while (0)
+#define STATS_ROWS(id, n, b) (statsOf[id].rows += (n), statsOf[id].bytes += (b))
+#define STATS_END(id) statsEnd(id)
+#define STATS_REPORT(n, seconds) statsReport(n, seconds)
+#define STATS_ONLY(...) do { __VA_ARGS__; } while (0)
+
+#else /* !INSTRUMENT */
+
+#define STATS_BEGIN(id) ((void) 0)
+#define STATS_WAIT(id, ...) do { __VA_ARGS__; } while (0)
+#define STATS_ROWS(id, n, b) ((void) 0)
+#define STATS_END(id) ((void) 0)
+#define STATS_REPORT(n, seconds) ((void) 0)
+#define STATS_ONLY(...) ((void) 0)
+
+#endif /* INSTRUMENT */
+
+#endif /* WORKERSTATS_H */